@@ -0,0 +1,251 @@
+/* Stream delta parsing: the pull scanner in api_parse_delta() against the
+ * cJSON tree walk it replaced, over a fixed set of chunks as a provider
+ * streams them. Prints deltas per second for each.
+ *
+ *   make bench            (or: bench/delta_bench [rounds]) */
+
+#include "api.h"
+#include "buf.h"
+#include "cJSON.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char* const CHUNKS[] = {
+    /* Role, then text */
+    "{\"id\":\"chatcmpl-9x8Yz\",\"object\":\"chat.completion.chunk\",\"created\":1718000000,\"model\":\"gpt-4o-mini\","
+    "\"system_fingerprint\":\"fp_0123456789\",\"choices\":[{\"index\":0,\"delta\":{\"role\":\"assistant\",\"content\":"
+    "\"\"},\"logprobs\":null,\"finish_reason\":null}],\"usage\":null}",
+    "{\"id\":\"chatcmpl-9x8Yz\",\"object\":\"chat.completion.chunk\",\"created\":1718000000,\"model\":\"gpt-4o-mini\","
+    "\"system_fingerprint\":\"fp_0123456789\",\"choices\":[{\"index\":0,\"delta\":{\"content\":\" the\"},\"logprobs\":"
+    "null,\"finish_reason\":null}],\"usage\":null}",
+    "{\"id\":\"chatcmpl-9x8Yz\",\"object\":\"chat.completion.chunk\",\"created\":1718000000,\"model\":\"gpt-4o-mini\","
+    "\"system_fingerprint\":\"fp_0123456789\",\"choices\":[{\"index\":0,\"delta\":{\"content\":\" \\\"quoted\\\"\\n\\n"
+    "\\u00e9t\\u00e9\"},\"logprobs\":null,\"finish_reason\":null}],\"usage\":null}",
+    /* Reasoning, the Ollama spelling */
+    "{\"id\":\"chatcmpl-412\",\"object\":\"chat.completion.chunk\",\"created\":1718000000,\"model\":\"qwen3:8b\","
+    "\"system_fingerprint\":\"fp_ollama\",\"choices\":[{\"index\":0,\"delta\":{\"role\":\"assistant\",\"content\":\"\","
+    "\"reasoning\":\" Let me check\"},\"finish_reason\":null}]}",
+    /* A tool call and its arguments */
+    "{\"id\":\"chatcmpl-9x8Yz\",\"object\":\"chat.completion.chunk\",\"created\":1718000000,\"model\":\"gpt-4o-mini\","
+    "\"choices\":[{\"index\":0,\"delta\":{\"tool_calls\":[{\"index\":0,\"id\":\"call_Ab12Cd34Ef56\",\"type\":"
+    "\"function\",\"function\":{\"name\":\"read_file\",\"arguments\":\"\"}}]},\"logprobs\":null,\"finish_reason\":"
+    "null}],\"usage\":null}",
+    "{\"id\":\"chatcmpl-9x8Yz\",\"object\":\"chat.completion.chunk\",\"created\":1718000000,\"model\":\"gpt-4o-mini\","
+    "\"choices\":[{\"index\":0,\"delta\":{\"tool_calls\":[{\"index\":0,\"function\":{\"arguments\":"
+    "\"{\\\"path\\\": \\\"src/ma\"}}]},\"logprobs\":null,\"finish_reason\":null}],\"usage\":null}",
+    /* Finish, then usage */
+    "{\"id\":\"chatcmpl-9x8Yz\",\"object\":\"chat.completion.chunk\",\"created\":1718000000,\"model\":\"gpt-4o-mini\","
+    "\"choices\":[{\"index\":0,\"delta\":{},\"logprobs\":null,\"finish_reason\":\"stop\"}],\"usage\":null}",
+    "{\"id\":\"chatcmpl-9x8Yz\",\"object\":\"chat.completion.chunk\",\"created\":1718000000,\"model\":\"gpt-4o-mini\","
+    "\"choices\":[],\"usage\":{\"prompt_tokens\":1532,\"completion_tokens\":287,\"total_tokens\":1819,"
+    "\"prompt_tokens_details\":{\"cached_tokens\":1024}}}",
+};
+
+#define CHUNK_COUNT ((int)(sizeof(CHUNKS) / sizeof(CHUNKS[0])))
+
+/* api_parse_delta() before the scanner, with its owned strings */
+typedef struct
+{
+    char* content;
+    char* reasoning_content;
+    int tool_call_index;
+    char* tc_id;
+    char* tc_name;
+    char* tc_arguments;
+    int input_tokens;
+    int output_tokens;
+} tree_delta_t;
+
+static char* dup_string(const cJSON* j)
+{
+    return cJSON_IsString(j) ? strdup(j->valuestring) : NULL;
+}
+
+static int tree_parse_delta(const char* json, size_t len, tree_delta_t* out)
+{
+    memset(out, 0, sizeof(*out));
+    out->tool_call_index = -1;
+
+    cJSON* root = cJSON_ParseWithLength(json, len);
+    if (!root)
+    {
+        return -1;
+    }
+
+    cJSON* usage = cJSON_GetObjectItem(root, "usage");
+    if (usage)
+    {
+        cJSON* pt = cJSON_GetObjectItem(usage, "prompt_tokens");
+        cJSON* ct = cJSON_GetObjectItem(usage, "completion_tokens");
+        if (pt && cJSON_IsNumber(pt))
+        {
+            out->input_tokens = pt->valueint;
+        }
+        if (ct && cJSON_IsNumber(ct))
+        {
+            out->output_tokens = ct->valueint;
+        }
+    }
+
+    cJSON* choices = cJSON_GetObjectItem(root, "choices");
+    cJSON* delta = choices ? cJSON_GetObjectItem(cJSON_GetArrayItem(choices, 0), "delta") : NULL;
+    if (delta)
+    {
+        out->content = dup_string(cJSON_GetObjectItem(delta, "content"));
+        cJSON* reasoning = cJSON_GetObjectItem(delta, "reasoning_content");
+        if (!reasoning)
+        {
+            reasoning = cJSON_GetObjectItem(delta, "reasoning");
+        }
+        out->reasoning_content = dup_string(reasoning);
+
+        cJSON* tcs = cJSON_GetObjectItem(delta, "tool_calls");
+        if (tcs && cJSON_GetArraySize(tcs) > 0)
+        {
+            cJSON* tc = cJSON_GetArrayItem(tcs, 0);
+            cJSON* idx = cJSON_GetObjectItem(tc, "index");
+            if (idx && cJSON_IsNumber(idx))
+            {
+                out->tool_call_index = idx->valueint;
+            }
+            out->tc_id = dup_string(cJSON_GetObjectItem(tc, "id"));
+            cJSON* fn = cJSON_GetObjectItem(tc, "function");
+            if (fn)
+            {
+                out->tc_name = dup_string(cJSON_GetObjectItem(fn, "name"));
+                out->tc_arguments = dup_string(cJSON_GetObjectItem(fn, "arguments"));
+            }
+        }
+    }
+
+    cJSON_Delete(root);
+    return 0;
+}
+
+static void tree_delta_free(tree_delta_t* d)
+{
+    free(d->content);
+    free(d->reasoning_content);
+    free(d->tc_id);
+    free(d->tc_name);
+    free(d->tc_arguments);
+}
+
+static int same_str(const char* a, const char* b)
+{
+    return (!a && !b) || (a && b && strcmp(a, b) == 0);
+}
+
+/* Both parsers must agree on every chunk, or the numbers mean nothing */
+static int check(void)
+{
+    buf_t scratch = { 0 };
+    int bad = 0;
+    for (int i = 0; i < CHUNK_COUNT; i++)
+    {
+        size_t len = strlen(CHUNKS[i]);
+        delta_t d;
+        tree_delta_t t;
+        int rd = api_parse_delta(CHUNKS[i], len, &scratch, &d);
+        int rt = tree_parse_delta(CHUNKS[i], len, &t);
+        if (rd != 0 || rt != 0 || !same_str(d.content, t.content) ||
+            !same_str(d.reasoning_content, t.reasoning_content) || d.tool_call_index != t.tool_call_index ||
+            !same_str(d.tc_id, t.tc_id) || !same_str(d.tc_name, t.tc_name) ||
+            !same_str(d.tc_arguments, t.tc_arguments) || d.input_tokens != t.input_tokens ||
+            d.output_tokens != t.output_tokens)
+        {
+            fprintf(stderr, "delta_bench: parsers disagree on chunk %d\n", i);
+            bad = 1;
+        }
+        if (rt == 0)
+        {
+            tree_delta_free(&t);
+        }
+    }
+    buf_free(&scratch);
+    return bad ? -1 : 0;
+}
+
+static double seconds_since(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Keeps the results observable so the loops are not optimized away */
+static volatile long g_sink;
+
+static double run_scanner(long rounds, const size_t* lens)
+{
+    buf_t scratch = { 0 };
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < CHUNK_COUNT; i++)
+        {
+            delta_t d;
+            api_parse_delta(CHUNKS[i], lens[i], &scratch, &d);
+            g_sink += d.content ? d.content[0] : d.input_tokens;
+        }
+    }
+    double secs = seconds_since(&start);
+    buf_free(&scratch);
+    return secs;
+}
+
+static double run_tree(long rounds, const size_t* lens)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < CHUNK_COUNT; i++)
+        {
+            tree_delta_t d;
+            tree_parse_delta(CHUNKS[i], lens[i], &d);
+            g_sink += d.content ? d.content[0] : d.input_tokens;
+            tree_delta_free(&d);
+        }
+    }
+    return seconds_since(&start);
+}
+
+int main(int argc, char** argv)
+{
+    long rounds = argc > 1 ? atol(argv[1]) : 200000;
+    if (rounds <= 0)
+    {
+        fprintf(stderr, "Usage: %s [rounds]\n", argv[0]);
+        return 2;
+    }
+    if (check() < 0)
+    {
+        return 1;
+    }
+
+    size_t lens[CHUNK_COUNT];
+    size_t bytes = 0;
+    for (int i = 0; i < CHUNK_COUNT; i++)
+    {
+        lens[i] = strlen(CHUNKS[i]);
+        bytes += lens[i];
+    }
+
+    /* One warm-up round each, then the timed ones */
+    run_scanner(1, lens);
+    run_tree(1, lens);
+    double scan_secs = run_scanner(rounds, lens);
+    double tree_secs = run_tree(rounds, lens);
+
+    double deltas = (double)rounds * CHUNK_COUNT;
+    printf("%d chunks, %zu bytes, %ld rounds\n", CHUNK_COUNT, bytes, rounds);
+    printf("scanner  %12.0f deltas/s  %8.1f MB/s\n", deltas / scan_secs, (double)bytes * rounds / scan_secs / 1e6);
+    printf("cJSON    %12.0f deltas/s  %8.1f MB/s\n", deltas / tree_secs, (double)bytes * rounds / tree_secs / 1e6);
+    printf("speedup  %12.2fx\n", tree_secs / scan_secs);
+    return 0;
+}
@@ -40,7 +40,7 @@ _art_completion() {
     esac
 
     if [[ ${cur} == -* ]]; then
-        COMPREPLY=($(compgen -W "-a --agent -p --prompt-name -s --system-prompt -m --markdown --logging --list-agents --list-prompts --get-current-agent --tools --tool-approval --tool-output --install --add-prompt --new-prompt --no-session" -- "${cur}"))
+        COMPREPLY=($(compgen -W "-a --agent -p --prompt-name -s --system-prompt -m --markdown --logging --list-agents --list-prompts --get-current-agent --tools --tool-approval --tool-output --install --add-prompt --new-prompt --no-session --stats" -- "${cur}"))
     fi
 }
 
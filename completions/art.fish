@@ -18,6 +18,7 @@ complete -c art -l install -d 'Install default configuration'
 complete -c art -l add-prompt -d 'Add a prompt file' -r -F
 complete -c art -l new-prompt -d 'Create a new prompt' -r
 complete -c art -l no-session -d 'Disable saving session'
+complete -c art -l stats -d 'Print token and allocation counts at exit'
 
 # Complete @file attachments
 complete -c art -a '(for f in (commandline -ct | string replace -r "^@" "" | string collect); __fish_complete_path "$f" | string replace -r "^" "@"; end)' -n 'string match -q "@*" (commandline -ct)'
@@ -18,11 +18,12 @@ echo "cJSON downloaded to vendor/cJSON/"
 echo ""
 echo "System dependencies needed (install via package manager):"
 echo "  - libcurl (dev headers)   e.g. libcurl4-openssl-dev / libcurl-devel"
+echo "  - zlib (dev headers)      e.g. zlib1g-dev / zlib-devel"
 echo "  - libyaml (dev headers)   e.g. libyaml-dev / libyaml-devel"
 echo "  - C++20 compiler          e.g. g++ >= 10 / clang++ >= 13"
 echo "  - cmake >= 3.20"
 echo ""
-echo "On Debian/Ubuntu:  sudo apt install libcurl4-openssl-dev libyaml-dev g++ cmake"
-echo "On Fedora/RHEL:    sudo dnf install libcurl-devel libyaml-devel gcc-c++ cmake"
+echo "On Debian/Ubuntu:  sudo apt install libcurl4-openssl-dev zlib1g-dev libyaml-dev g++ cmake"
+echo "On Fedora/RHEL:    sudo dnf install libcurl-devel zlib-devel libyaml-devel gcc-c++ cmake"
 echo "On macOS:          brew install curl libyaml cmake"
-echo "On Arch:           sudo pacman -S curl libyaml gcc cmake"
+echo "On Arch:           sudo pacman -S curl zlib libyaml gcc cmake"
@@ -1,80 +1,99 @@
 #include "agent.h"
 #include "api.h"
 #include "buf.h"
+#include "json.h"
 #include "tools.h"
+#include "util.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 void agent_init(agent_t* a, http_client_t* http, const char* model, const char* system_prompt, char** tool_patterns)
 {
     memset(a, 0, sizeof(*a));
-    a->messages = cJSON_CreateArray();
+    history_init(&a->history);
+    arena_init(&a->turn);
     a->http = http;
     a->model = model;
     a->tool_patterns = tool_patterns;
+    if (tool_patterns && tool_patterns[0])
+    {
+        a->tools_json = tools_get_schemas((const char**)tool_patterns);
+    }
 
     if (system_prompt && system_prompt[0])
     {
-        cJSON* sys_msg = cJSON_CreateObject();
-        cJSON_AddStringToObject(sys_msg, "role", "system");
-        cJSON_AddStringToObject(sys_msg, "content", system_prompt);
-        cJSON_AddItemToArray(a->messages, sys_msg);
+        history_add_text(&a->history, ROLE_SYSTEM, system_prompt);
     }
 }
 
 void agent_free(agent_t* a)
 {
-    cJSON_Delete(a->messages);
+    history_free(&a->history);
+    arena_free(&a->turn);
+    free(a->tools_json);
     tool_calls_free(a->pending, a->pending_count);
     /* tool_patterns is owned by caller */
 }
 
 void agent_add_user_message(agent_t* a, const char* content)
 {
-    cJSON* msg = cJSON_CreateObject();
-    cJSON_AddStringToObject(msg, "role", "user");
-    cJSON_AddStringToObject(msg, "content", content);
-    cJSON_AddItemToArray(a->messages, msg);
+    history_add_text(&a->history, ROLE_USER, content);
 }
 
 void agent_add_assistant_message(agent_t* a, const char* content, const tool_call_t* tool_calls, int tc_count)
 {
-    cJSON* msg = cJSON_CreateObject();
-    cJSON_AddStringToObject(msg, "role", "assistant");
+    size_t content_len = 0;
+    json_writer_t* w = history_begin(&a->history, ROLE_ASSISTANT);
     if (content)
     {
-        cJSON_AddStringToObject(msg, "content", content);
+        jw_key(w, "content");
+        jw_string(w, content);
+        content_len += strlen(content);
     }
 
     if (tool_calls && tc_count > 0)
     {
-        cJSON* tcs = cJSON_CreateArray();
+        jw_key(w, "tool_calls");
+        jw_array_begin(w);
         for (int i = 0; i < tc_count; i++)
         {
-            cJSON* tc = cJSON_CreateObject();
-            cJSON_AddStringToObject(tc, "id", tool_calls[i].id);
-            cJSON_AddStringToObject(tc, "type", "function");
-            cJSON* fn = cJSON_CreateObject();
-            cJSON_AddStringToObject(fn, "name", tool_calls[i].name);
-            cJSON_AddStringToObject(fn, "arguments", tool_calls[i].raw_args ? tool_calls[i].raw_args : "{}");
-            cJSON_AddItemToObject(tc, "function", fn);
-            cJSON_AddItemToArray(tcs, tc);
+            const char* args = tool_calls[i].raw_args ? tool_calls[i].raw_args : "{}";
+            jw_object_begin(w);
+            jw_key(w, "id");
+            jw_string(w, tool_calls[i].id);
+            jw_key(w, "type");
+            jw_string(w, "function");
+            jw_key(w, "function");
+            jw_object_begin(w);
+            jw_key(w, "name");
+            jw_string(w, tool_calls[i].name);
+            jw_key(w, "arguments");
+            jw_string(w, args);
+            jw_object_end(w);
+            jw_object_end(w);
+            content_len += strlen(args);
         }
-        cJSON_AddItemToObject(msg, "tool_calls", tcs);
+        jw_array_end(w);
     }
 
-    cJSON_AddItemToArray(a->messages, msg);
+    history_end(&a->history, content_len);
 }
 
 void agent_add_tool_result(agent_t* a, const char* tool_call_id, const char* content)
 {
-    cJSON* msg = cJSON_CreateObject();
-    cJSON_AddStringToObject(msg, "role", "tool");
-    cJSON_AddStringToObject(msg, "tool_call_id", tool_call_id);
-    cJSON_AddStringToObject(msg, "content", content);
-    cJSON_AddItemToArray(a->messages, msg);
+    json_writer_t* w = history_begin(&a->history, ROLE_TOOL);
+    jw_key(w, "tool_call_id");
+    jw_string(w, tool_call_id);
+    jw_key(w, "content");
+    jw_string(w, content);
+    history_end(&a->history, content ? strlen(content) : 0);
 
     /* Remove from pending */
     for (int i = 0; i < a->pending_count; i++)
@@ -95,16 +114,9 @@ void agent_add_tool_result(agent_t* a, const char* tool_call_id, const char* con
 
 void agent_pop_last_user_message(agent_t* a)
 {
-    int size = cJSON_GetArraySize(a->messages);
-    if (size == 0)
-    {
-        return;
-    }
-    cJSON* last = cJSON_GetArrayItem(a->messages, size - 1);
-    cJSON* role = cJSON_GetObjectItem(last, "role");
-    if (role && cJSON_IsString(role) && strcmp(role->valuestring, "user") == 0)
+    if (history_last_role(&a->history) == ROLE_USER)
     {
-        cJSON_DeleteItemFromArray(a->messages, size - 1);
+        history_pop(&a->history);
     }
 }
 
@@ -131,11 +143,21 @@ typedef struct
     buf_t id_buf;
     buf_t name_buf;
     buf_t args_buf;
+    int depth; /* nesting of args_buf so far, see args_complete() */
+    int in_string;
+    int escaped;
+    int complete;
 } raw_tc_t;
 
+struct hedge_leg;
+
+/* Everything but text lives in the per-turn arena: tool-call fragments and
+ * the delta scratch are dropped wholesale by arena_reset. */
 typedef struct
 {
+    arena_t* arena;
     buf_t text;
+    buf_t scratch; /* reused by api_parse_delta for every chunk */
     raw_tc_t* raw_tcs;
     int raw_tc_count;
     int raw_tc_cap;
@@ -145,13 +167,230 @@ typedef struct
     chunk_fn on_reasoning_chunk;
     void* on_chunk_data;
     int reasoning_seen; /* non-zero once any reasoning delta has been streamed */
+    tool_ready_fn on_tool_ready;
+    void* tool_ready_data;
+    struct hedge_leg* leg; /* set while racing a hedged request */
+    char stream_error[256]; /* data of an "error" event, "" if none came */
 } send_ctx_t;
 
-static void on_sse_event(const char* json, size_t len, void* userdata)
+/* A stream that completed but carried an "error" event has failed */
+static int check_stream_error(const send_ctx_t* ctx, int ret, char* errbuf, size_t errlen)
+{
+    if (ret == 0 && ctx->stream_error[0])
+    {
+        snprintf(errbuf, errlen, "Stream error: %s", ctx->stream_error);
+        return -1;
+    }
+    return ret;
+}
+
+/* ---- Hedged requests ---- */
+
+typedef struct hedge_run hedge_run_t;
+
+typedef struct hedge_leg
+{
+    hedge_run_t* run;
+    int index;
+    rope_t body; /* built per route, since the model differs */
+    send_ctx_t ctx;
+    http_request_t* req;
+    int done;
+    int ret;
+    char err[512];
+} hedge_leg_t;
+
+struct hedge_run
+{
+    pthread_mutex_t lock; /* guards everything below */
+    pthread_cond_t cond;
+    const agent_hedge_t* hedge;
+    hedge_leg_t* legs;
+    int launched;
+    int finished;
+    int winner; /* leg that streamed the first token, -1 until then */
+    struct timespec start;
+    long first_token_ms;
+};
+
+static long ms_since(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+int agent_http_flags(const resolved_agent_t* ra)
+{
+    return (ra->gzip_request ? HTTP_GZIP_REQUEST : 0) | (ra->compress_response ? HTTP_ACCEPT_ENCODING : 0);
+}
+
+void agent_hedge_init(agent_hedge_t* h, const resolved_agent_t* ra, http_engine_t* engine)
+{
+    memset(h, 0, sizeof(*h));
+    h->name = ra->name;
+    h->count = ra->hedge_count;
+    h->delay_ms = ra->hedge_delay_ms;
+    h->engine = engine;
+    h->routes = calloc((size_t)h->count, sizeof(agent_route_t));
+    if (!h->routes)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < h->count; i++)
+    {
+        const resolved_agent_t* m = &ra->hedge[i];
+        agent_route_t* r = &h->routes[i];
+        r->name = m->name;
+        r->model = m->model;
+        http_init_engine(&r->http, m->base_url && m->base_url[0] ? m->base_url : DEFAULT_BASE_URL, m->api_key,
+            engine);
+        r->http.flags = agent_http_flags(m);
+    }
+}
+
+void agent_hedge_free(agent_hedge_t* h)
+{
+    for (int i = 0; i < h->count; i++)
+    {
+        http_free(&h->routes[i].http);
+    }
+    free(h->routes);
+    memset(h, 0, sizeof(*h));
+}
+
+/* Decide whether a leg's delta counts. The first leg to stream a token
+ * becomes the winner and cancels the rest; their later deltas are dropped.
+ * Runs on the engine thread, like every callback. */
+static int hedge_claim(hedge_leg_t* leg, const delta_t* d)
+{
+    hedge_run_t* run = leg->run;
+    int token = (d->content && d->content[0]) || d->reasoning_content || d->tool_call_index >= 0;
+
+    pthread_mutex_lock(&run->lock);
+    if (run->winner < 0 && token)
+    {
+        run->winner = leg->index;
+        run->first_token_ms = ms_since(&run->start);
+        for (int i = 0; i < run->launched; i++)
+        {
+            hedge_leg_t* other = &run->legs[i];
+            if (i != leg->index && !other->done && other->req)
+            {
+                http_request_cancel(run->hedge->engine, other->req);
+            }
+        }
+        pthread_cond_signal(&run->cond);
+    }
+    int live = run->winner < 0 || run->winner == leg->index;
+    pthread_mutex_unlock(&run->lock);
+    return live;
+}
+
+static void hedge_leg_done(int ret, const http_status_t* status, const char* err, void* userdata)
+{
+    (void)status;
+    hedge_leg_t* leg = userdata;
+    hedge_run_t* run = leg->run;
+    pthread_mutex_lock(&run->lock);
+    snprintf(leg->err, sizeof(leg->err), "%s", err);
+    leg->ret = check_stream_error(&leg->ctx, ret, leg->err, sizeof(leg->err));
+    leg->done = 1;
+    run->finished++;
+    pthread_cond_signal(&run->cond);
+    pthread_mutex_unlock(&run->lock);
+}
+
+/* One line per hedged request: time, agent, winning route ("-" if none),
+ * ms to its first token, configured delay and routes started. */
+static void hedge_log(const hedge_run_t* run)
+{
+    char* path = home_path("/.artifice/hedge.log");
+    if (!path)
+    {
+        return;
+    }
+    mkdir_parents(path);
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    free(path);
+    if (fd < 0)
+    {
+        return;
+    }
+    const agent_hedge_t* h = run->hedge;
+    char line[512];
+    int n = snprintf(line, sizeof(line), "%ld %s %s %ld %ld %d\n", (long)time(NULL), h->name ? h->name : "-",
+        run->winner >= 0 ? h->routes[run->winner].name : "-", run->winner >= 0 ? run->first_token_ms : -1L,
+        h->delay_ms, run->launched);
+    if (n > 0 && (size_t)n < sizeof(line))
+    {
+        /* A single O_APPEND write keeps concurrent processes' lines whole */
+        ssize_t w = write(fd, line, (size_t)n);
+        (void)w;
+    }
+    close(fd);
+}
+
+/* Follow the bracket nesting of a call's argument JSON as fragments
+ * arrive. Returns non-zero once its outermost object has closed. */
+static int args_complete(raw_tc_t* tc, const char* s)
+{
+    for (; *s && !tc->complete; s++)
+    {
+        char c = *s;
+        if (tc->in_string)
+        {
+            if (tc->escaped)
+            {
+                tc->escaped = 0;
+            }
+            else if (c == '\\')
+            {
+                tc->escaped = 1;
+            }
+            else if (c == '"')
+            {
+                tc->in_string = 0;
+            }
+        }
+        else if (c == '"')
+        {
+            tc->in_string = 1;
+        }
+        else if (c == '{' || c == '[')
+        {
+            tc->depth++;
+        }
+        else if ((c == '}' || c == ']') && tc->depth > 0 && --tc->depth == 0)
+        {
+            tc->complete = 1;
+        }
+    }
+    return tc->complete;
+}
+
+static void on_sse_event(const sse_event_t* ev, void* userdata)
 {
     send_ctx_t* ctx = userdata;
+    if (strcmp(ev->event, "error") == 0)
+    {
+        /* The first one says what went wrong; it has no delta */
+        if (!ctx->stream_error[0])
+        {
+            const char* data = ev->len > 0 ? ev->data : "no details";
+            size_t len = ev->len > 0 ? ev->len : strlen(data);
+            int n = len < sizeof(ctx->stream_error) ? (int)len : (int)sizeof(ctx->stream_error) - 1;
+            snprintf(ctx->stream_error, sizeof(ctx->stream_error), "%.*s", n, data);
+        }
+        return;
+    }
     delta_t d;
-    if (api_parse_delta(json, len, &d) < 0)
+    if (api_parse_delta(ev->data, ev->len, &ctx->scratch, &d) < 0)
+    {
+        return;
+    }
+    if (ctx->leg && !hedge_claim(ctx->leg, &d))
     {
         return;
     }
@@ -190,13 +429,16 @@ static void on_sse_event(const char* json, size_t len, void* userdata)
         {
             if (ctx->raw_tc_count >= ctx->raw_tc_cap)
             {
-                ctx->raw_tc_cap = ctx->raw_tc_cap ? ctx->raw_tc_cap * 2 : 4;
-                ctx->raw_tcs = realloc(ctx->raw_tcs, (size_t)ctx->raw_tc_cap * sizeof(raw_tc_t));
+                int cap = ctx->raw_tc_cap ? ctx->raw_tc_cap * 2 : 4;
+                ctx->raw_tcs = arena_grow(ctx->arena, ctx->raw_tcs, (size_t)ctx->raw_tc_cap * sizeof(raw_tc_t),
+                                          (size_t)cap * sizeof(raw_tc_t));
+                ctx->raw_tc_cap = cap;
             }
             raw_tc_t* tc = &ctx->raw_tcs[ctx->raw_tc_count];
-            buf_init(&tc->id_buf);
-            buf_init(&tc->name_buf);
-            buf_init(&tc->args_buf);
+            memset(tc, 0, sizeof(*tc));
+            buf_init_arena(&tc->id_buf, ctx->arena);
+            buf_init_arena(&tc->name_buf, ctx->arena);
+            buf_init_arena(&tc->args_buf, ctx->arena);
             ctx->raw_tc_count++;
         }
         raw_tc_t* tc = &ctx->raw_tcs[idx];
@@ -211,6 +453,10 @@ static void on_sse_event(const char* json, size_t len, void* userdata)
         if (d.tc_arguments)
         {
             buf_append_str(&tc->args_buf, d.tc_arguments);
+            if (!tc->complete && args_complete(tc, d.tc_arguments) && ctx->on_tool_ready && tc->name_buf.data)
+            {
+                ctx->on_tool_ready(idx, tc->name_buf.data, tc->args_buf.data, ctx->tool_ready_data);
+            }
         }
     }
 
@@ -223,8 +469,125 @@ static void on_sse_event(const char* json, size_t len, void* userdata)
     {
         ctx->output_tokens = d.output_tokens;
     }
+}
+
+/* Run the request on the hedge's routes and leave the chosen leg's results
+ * in *ctx: the winner's, else the first that succeeded, else an error. */
+static int hedge_stream(agent_t* a, send_ctx_t* ctx, char* errbuf, size_t errlen)
+{
+    const agent_hedge_t* h = a->hedge;
+    hedge_run_t run;
+    memset(&run, 0, sizeof(run));
+    run.hedge = h;
+    run.winner = -1;
+    run.legs = arena_alloc(&a->turn, (size_t)h->count * sizeof(hedge_leg_t));
+    memset(run.legs, 0, (size_t)h->count * sizeof(hedge_leg_t));
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&run.cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    /* Every body is built up front: once streams run, the engine thread
+     * allocates from the same arena */
+    for (int i = 0; i < h->count; i++)
+    {
+        hedge_leg_t* leg = &run.legs[i];
+        leg->run = &run;
+        leg->index = i;
+        rope_init(&leg->body, &a->turn);
+        api_build_request(&leg->body, h->routes[i].model, a->history.wire.data ? a->history.wire.data : "",
+                          a->history.wire.len, a->tools_json);
+        leg->ctx = *ctx;
+        buf_init(&leg->ctx.text);
+        buf_init_arena(&leg->ctx.scratch, &a->turn);
+        leg->ctx.leg = leg;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &run.start);
+    pthread_mutex_lock(&run.lock);
+    for (int i = 0; i < h->count; i++)
+    {
+        hedge_leg_t* leg = &run.legs[i];
+        const http_client_t* c = &h->routes[i].http;
+        leg->req = http_engine_submit(
+            h->engine, c->base_url, c->api_key, &leg->body, c->flags, on_sse_event, &leg->ctx, hedge_leg_done, leg);
+        run.launched++;
+        if (!leg->req)
+        {
+            leg->done = 1;
+            leg->ret = -1;
+            snprintf(leg->err, sizeof(leg->err), "HTTP engine unavailable");
+            run.finished++;
+        }
+        if (i == h->count - 1)
+        {
+            break;
+        }
+
+        /* Give the routes started so far delay_ms to produce a token;
+         * move on early if they have all failed */
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += h->delay_ms / 1000;
+        deadline.tv_nsec += (h->delay_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (run.winner < 0 && run.finished < run.launched && !g_http_interrupted)
+        {
+            if (pthread_cond_timedwait(&run.cond, &run.lock, &deadline) == ETIMEDOUT)
+            {
+                break;
+            }
+        }
+        if (run.winner >= 0 || g_http_interrupted)
+        {
+            break;
+        }
+    }
+    while (run.finished < run.launched)
+    {
+        pthread_cond_wait(&run.cond, &run.lock);
+    }
+    pthread_mutex_unlock(&run.lock);
 
-    delta_free(&d);
+    int pick = run.winner;
+    for (int i = 0; pick < 0 && i < run.launched; i++)
+    {
+        if (run.legs[i].ret == 0)
+        {
+            pick = i;
+        }
+    }
+    /* All failed: report the latest failure that has a message */
+    for (int i = run.launched - 1; pick < 0 && i >= 0; i--)
+    {
+        if (run.legs[i].err[0] || i == 0)
+        {
+            pick = i;
+        }
+    }
+
+    int ret = run.legs[pick].ret;
+    snprintf(errbuf, errlen, "%s", run.legs[pick].err);
+    *ctx = run.legs[pick].ctx;
+    ctx->leg = NULL;
+    for (int i = 0; i < h->count; i++)
+    {
+        if (i != pick)
+        {
+            buf_free(&run.legs[i].ctx.text);
+        }
+    }
+
+    hedge_log(&run);
+    pthread_cond_destroy(&run.cond);
+    pthread_mutex_destroy(&run.lock);
+    return ret;
 }
 
 int agent_send(agent_t* a, const char* prompt, chunk_fn on_chunk, chunk_fn on_reasoning_chunk, void* on_chunk_data, agent_response_t* out)
@@ -244,49 +607,80 @@ int agent_send(agent_t* a, const char* prompt, chunk_fn on_chunk, chunk_fn on_re
         }
     }
 
-    /* Get tool schemas */
-    cJSON* tools = NULL;
-    if (a->tool_patterns && a->tool_patterns[0])
-    {
-        tools = tools_get_schemas((const char**)a->tool_patterns);
-    }
-
-    /* Build request */
-    char* json_body = api_build_request(a->model, a->messages, tools);
-
     /* Set up SSE context */
     send_ctx_t ctx;
     memset(&ctx, 0, sizeof(ctx));
+    ctx.arena = &a->turn;
     buf_init(&ctx.text);
+    buf_init_arena(&ctx.scratch, &a->turn);
     ctx.on_chunk = on_chunk;
     ctx.on_reasoning_chunk = on_reasoning_chunk;
     ctx.on_chunk_data = on_chunk_data;
+    ctx.on_tool_ready = a->on_tool_ready;
+    ctx.tool_ready_data = a->tool_ready_data;
 
     /* Make the streaming request */
     char errbuf[512] = { 0 };
-    int ret = http_stream_chat(a->http, json_body, on_sse_event, &ctx, errbuf, sizeof(errbuf));
-    free(json_body);
-    if (tools)
+    int ret;
+    if (a->hedge && a->hedge->count > 1)
+    {
+        ret = hedge_stream(a, &ctx, errbuf, sizeof(errbuf));
+    }
+    else
     {
-        cJSON_Delete(tools);
+        /* Build request; the body references history and schemas in place */
+        rope_t body;
+        rope_init(&body, &a->turn);
+        api_build_request(&body, a->model, a->history.wire.data ? a->history.wire.data : "", a->history.wire.len,
+                          a->tools_json);
+        /* Transient failures are retried only while nothing has been shown */
+        int attempt = 0;
+        while ((ret = http_stream_chat(a->http, &body, on_sse_event, &ctx, errbuf, sizeof(errbuf))) < 0 &&
+            ctx.text.len == 0 && ctx.raw_tc_count == 0 && !ctx.reasoning_seen)
+        {
+            long delay = http_retry_delay(a->http, attempt);
+            if (delay < 0)
+            {
+                break;
+            }
+            if (http_sleep(delay) < 0)
+            {
+                errbuf[0] = '\0';
+                break;
+            }
+            attempt++;
+            ctx.input_tokens = 0;
+            ctx.output_tokens = 0;
+        }
+        if (ret == 0)
+        {
+            http_settle_usage(a->http, (long)ctx.input_tokens + ctx.output_tokens);
+        }
+        else if (attempt > 0 && errbuf[0])
+        {
+            size_t len = strlen(errbuf);
+            snprintf(errbuf + len, sizeof(errbuf) - len, " (after %d %s)", attempt, attempt == 1 ? "retry" : "retries");
+        }
     }
+    ret = check_stream_error(&ctx, ret, errbuf, sizeof(errbuf));
 
     if (ret < 0)
     {
         out->error = strdup(errbuf);
+        /* What was already streamed goes back with the error, but stays out
+         * of history so the turn can simply be sent again */
+        if (errbuf[0] && (ctx.text.len > 0 || ctx.raw_tc_count > 0 || ctx.reasoning_seen))
+        {
+            out->partial = 1;
+            out->text = ctx.text.len > 0 ? buf_detach(&ctx.text) : NULL;
+        }
         /* Pop the user message we added */
         if (prompt && prompt[0])
         {
             agent_pop_last_user_message(a);
         }
         buf_free(&ctx.text);
-        for (int i = 0; i < ctx.raw_tc_count; i++)
-        {
-            buf_free(&ctx.raw_tcs[i].id_buf);
-            buf_free(&ctx.raw_tcs[i].name_buf);
-            buf_free(&ctx.raw_tcs[i].args_buf);
-        }
-        free(ctx.raw_tcs);
+        arena_reset(&a->turn);
         return -1;
     }
 
@@ -316,7 +710,7 @@ int agent_send(agent_t* a, const char* prompt, chunk_fn on_chunk, chunk_fn on_re
             }
         }
     }
-    free(ctx.raw_tcs);
+    arena_reset(&a->turn);
 
     /* Add assistant message to history */
     char* text = buf_detach(&ctx.text);
@@ -1,12 +1,21 @@
 #ifndef AGENT_H
 #define AGENT_H
 
+#include "arena.h"
+#include "config.h"
+#include "engine.h"
+#include "history.h"
 #include "http.h"
 
 #include <cJSON.h>
 
 typedef void (*chunk_fn)(const char* text, void* userdata);
 
+/* A tool call whose argument JSON has fully arrived while the rest of the
+ * response is still streaming. index is its position among the response's
+ * tool calls; name and raw_args are only valid during the call. */
+typedef void (*tool_ready_fn)(int index, const char* name, const char* raw_args, void* userdata);
+
 typedef struct
 {
     char* id;
@@ -15,16 +24,53 @@ typedef struct
     char* raw_args; /* unparsed JSON string */
 } tool_call_t;
 
+/* One member of a hedged agent. */
+typedef struct
+{
+    const char* name;
+    const char* model;
+    http_client_t http; /* runs on the hedge's engine */
+} agent_route_t;
+
+/* Requests of a hedged agent go to routes[0] first, and to each next route
+ * if no token has streamed delay_ms after the previous one started (or at
+ * once if it failed). The first route to stream a token wins and the others
+ * are cancelled. Each outcome is appended to ~/.artifice/hedge.log. */
 typedef struct
 {
-    cJSON* messages; /* cJSON array — the conversation history */
+    const char* name; /* the hedged agent */
+    agent_route_t* routes;
+    int count;
+    long delay_ms;
+    http_engine_t* engine;
+} agent_hedge_t;
+
+/* Set up one route per member of ra, which must be hedged. ra must outlive h. */
+void agent_hedge_init(agent_hedge_t* h, const resolved_agent_t* ra, http_engine_t* engine);
+void agent_hedge_free(agent_hedge_t* h);
+
+/* HTTP_* flags for requests on behalf of ra. */
+int agent_http_flags(const resolved_agent_t* ra);
+
+typedef struct
+{
+    history_t history; /* the conversation, in wire format */
     tool_call_t* pending; /* pending tool calls from last response */
     int pending_count;
+    arena_t turn; /* transient memory of one agent_send, reset when it returns */
 
     /* Provider config */
     http_client_t* http;
     const char* model;
+    const agent_hedge_t* hedge; /* race requests across its routes, or NULL */
     char** tool_patterns; /* NULL-terminated, e.g. {"*", NULL} */
+    char* tools_json; /* tool schemas resolved from tool_patterns, or NULL */
+
+    /* Optional; called as each tool call completes mid-stream, from the
+     * engine thread when hedged. Calls usually complete in index order but
+     * are not guaranteed to. */
+    tool_ready_fn on_tool_ready;
+    void* tool_ready_data;
 } agent_t;
 
 typedef struct
@@ -35,6 +81,7 @@ typedef struct
     int input_tokens;
     int output_tokens;
     char* error; /* NULL on success */
+    int partial; /* the error struck mid-stream; text holds what was streamed */
 } agent_response_t;
 
 void agent_init(agent_t* a, http_client_t* http, const char* model, const char* system_prompt, char** tool_patterns);
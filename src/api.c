@@ -1,135 +1,662 @@
 #include "api.h"
+#include "json.h"
 
 #include <stdlib.h>
 #include <string.h>
 
-char* api_build_request(const char* model, cJSON* messages, cJSON* tools)
+void api_build_request(rope_t* body, const char* model, const char* messages_json, size_t messages_len,
+                       const char* tools_json)
 {
-    cJSON* root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "model", model);
-    cJSON_AddBoolToObject(root, "stream", 1);
+    /* Only the model name is copied; history and tool schemas are referenced */
+    buf_t head;
+    buf_init_arena(&head, body->arena);
+    buf_append_str(&head, "{\"model\":");
+    json_escape(&head, model ? model : "", model ? strlen(model) : 0);
+    buf_append_str(&head, ",\"stream\":true,\"stream_options\":{\"include_usage\":true},\"messages\":[");
+    rope_ref(body, head.data, head.len);
+    rope_ref(body, messages_json, messages_len);
+    rope_ref_str(body, "]");
+    if (tools_json)
+    {
+        rope_ref_str(body, ",\"tools\":");
+        rope_ref_str(body, tools_json);
+        rope_ref_str(body, ",\"tool_choice\":\"auto\"");
+    }
+    rope_ref_str(body, "}");
+}
+
+/* ---- Delta scanner ----
+ *
+ * A pull scanner over the raw chunk bytes. It walks only the paths we care
+ * about (usage, choices[0].delta) and skips everything else without
+ * materializing it, so a typical content delta costs no allocations once the
+ * scratch buffer has grown. */
 
-    cJSON* stream_opts = cJSON_CreateObject();
-    cJSON_AddBoolToObject(stream_opts, "include_usage", 1);
-    cJSON_AddItemToObject(root, "stream_options", stream_opts);
+#define NO_STR ((size_t)-1)
 
-    cJSON_AddItemReferenceToObject(root, "messages", messages);
+typedef struct
+{
+    const char* p;
+    const char* end;
+    buf_t* scratch;
+} json_scan_t;
+
+/* Scratch offsets of the extracted strings; resolved to pointers at the end
+ * because the scratch buffer may move while it grows. */
+typedef struct
+{
+    size_t content;
+    size_t reasoning_content;
+    size_t reasoning;
+    size_t tc_id;
+    size_t tc_name;
+    size_t tc_arguments;
+} delta_offs_t;
 
-    if (tools && cJSON_GetArraySize(tools) > 0)
+static int js_peek(json_scan_t* s)
+{
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r'))
     {
-        cJSON_AddItemReferenceToObject(root, "tools", tools);
-        cJSON_AddStringToObject(root, "tool_choice", "auto");
+        s->p++;
     }
+    return s->p < s->end ? (unsigned char)*s->p : -1;
+}
 
-    char* json = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
-    return json;
+/* Find the closing quote of the string starting at s->p (just past the
+ * opening quote). Sets *escaped if the string contains escapes. */
+static const char* js_string_end(json_scan_t* s, int* escaped)
+{
+    const char* q = s->p;
+    *escaped = 0;
+    while (q < s->end)
+    {
+        if (*q == '"')
+        {
+            return q;
+        }
+        if (*q == '\\')
+        {
+            *escaped = 1;
+            q += 2;
+            continue;
+        }
+        q++;
+    }
+    return NULL;
 }
 
-int api_parse_delta(const char* json, size_t len, delta_t* out)
+static int js_hex4(const char* q, const char* end, unsigned* out)
 {
-    memset(out, 0, sizeof(*out));
-    out->tool_call_index = -1;
+    if (end - q < 4)
+    {
+        return -1;
+    }
+    unsigned v = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        char c = q[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9')
+        {
+            v |= (unsigned)(c - '0');
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            v |= (unsigned)(c - 'a' + 10);
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            v |= (unsigned)(c - 'A' + 10);
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    *out = v;
+    return 0;
+}
+
+static void js_put_utf8(buf_t* b, unsigned cp)
+{
+    char u[4];
+    size_t n;
+    if (cp < 0x80)
+    {
+        u[0] = (char)cp;
+        n = 1;
+    }
+    else if (cp < 0x800)
+    {
+        u[0] = (char)(0xC0 | (cp >> 6));
+        u[1] = (char)(0x80 | (cp & 0x3F));
+        n = 2;
+    }
+    else if (cp < 0x10000)
+    {
+        u[0] = (char)(0xE0 | (cp >> 12));
+        u[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        u[2] = (char)(0x80 | (cp & 0x3F));
+        n = 3;
+    }
+    else
+    {
+        u[0] = (char)(0xF0 | (cp >> 18));
+        u[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        u[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        u[3] = (char)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+    buf_append(b, u, n);
+}
 
-    cJSON* root = cJSON_ParseWithLength(json, len);
-    if (!root)
+/* Unescape the string at s->p into the scratch buffer, NUL-terminated.
+ * Stores its offset in *off. If off is NULL the string is only skipped. */
+static int js_string(json_scan_t* s, size_t* off)
+{
+    if (js_peek(s) != '"')
     {
         return -1;
     }
+    s->p++;
+    int escaped;
+    const char* close = js_string_end(s, &escaped);
+    if (!close)
+    {
+        return -1;
+    }
+    if (!off)
+    {
+        s->p = close + 1;
+        return 0;
+    }
 
-    /* Usage (usually on last chunk) */
-    cJSON* usage = cJSON_GetObjectItem(root, "usage");
-    if (usage)
+    buf_t* b = s->scratch;
+    *off = b->len;
+    if (!escaped)
     {
-        cJSON* pt = cJSON_GetObjectItem(usage, "prompt_tokens");
-        cJSON* ct = cJSON_GetObjectItem(usage, "completion_tokens");
-        if (pt && cJSON_IsNumber(pt))
+        buf_append(b, s->p, (size_t)(close - s->p));
+        buf_append(b, "", 1);
+        s->p = close + 1;
+        return 0;
+    }
+
+    const char* q = s->p;
+    while (q < close)
+    {
+        const char* bs = memchr(q, '\\', (size_t)(close - q));
+        if (!bs)
         {
-            out->input_tokens = pt->valueint;
+            buf_append(b, q, (size_t)(close - q));
+            break;
         }
-        if (ct && cJSON_IsNumber(ct))
+        buf_append(b, q, (size_t)(bs - q));
+        q = bs + 1;
+        char c = *q++;
+        switch (c)
+        {
+        case '"':
+        case '\\':
+        case '/':
+            buf_append(b, &c, 1);
+            break;
+        case 'b':
+            buf_append(b, "\b", 1);
+            break;
+        case 'f':
+            buf_append(b, "\f", 1);
+            break;
+        case 'n':
+            buf_append(b, "\n", 1);
+            break;
+        case 'r':
+            buf_append(b, "\r", 1);
+            break;
+        case 't':
+            buf_append(b, "\t", 1);
+            break;
+        case 'u':
         {
-            out->output_tokens = ct->valueint;
+            unsigned cp;
+            if (js_hex4(q, close, &cp) < 0)
+            {
+                return -1;
+            }
+            q += 4;
+            if (cp >= 0xD800 && cp <= 0xDBFF)
+            {
+                unsigned lo;
+                if (close - q >= 6 && q[0] == '\\' && q[1] == 'u' && js_hex4(q + 2, close, &lo) == 0
+                    && lo >= 0xDC00 && lo <= 0xDFFF)
+                {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    q += 6;
+                }
+                else
+                {
+                    cp = 0xFFFD;
+                }
+            }
+            else if (cp >= 0xDC00 && cp <= 0xDFFF)
+            {
+                cp = 0xFFFD;
+            }
+            js_put_utf8(b, cp);
+            break;
+        }
+        default:
+            return -1;
         }
     }
+    buf_append(b, "", 1);
+    s->p = close + 1;
+    return 0;
+}
 
-    cJSON* choices = cJSON_GetObjectItem(root, "choices");
-    if (!choices || cJSON_GetArraySize(choices) == 0)
+static int js_int(json_scan_t* s, int* out)
+{
+    js_peek(s);
+    const char* q = s->p;
+    int neg = 0;
+    if (q < s->end && *q == '-')
     {
-        cJSON_Delete(root);
-        return 0;
+        neg = 1;
+        q++;
+    }
+    if (q >= s->end || *q < '0' || *q > '9')
+    {
+        return -1;
     }
+    long long v = 0;
+    for (; q < s->end && *q >= '0' && *q <= '9'; q++)
+    {
+        if (v < 1000000000000LL)
+        {
+            v = v * 10 + (*q - '0');
+        }
+    }
+    /* Fraction and exponent are accepted but truncated away */
+    while (q < s->end && (*q == '.' || *q == 'e' || *q == 'E' || *q == '+' || *q == '-' || (*q >= '0' && *q <= '9')))
+    {
+        q++;
+    }
+    if (neg)
+    {
+        v = -v;
+    }
+    *out = v > 2147483647LL ? 2147483647 : (v < -2147483647LL ? -2147483647 : (int)v);
+    s->p = q;
+    return 0;
+}
 
-    cJSON* choice0 = cJSON_GetArrayItem(choices, 0);
-    cJSON* delta = cJSON_GetObjectItem(choice0, "delta");
-    if (!delta)
+/* Skip any JSON value. Containers are matched by bracket depth only. */
+static int js_skip(json_scan_t* s)
+{
+    int c = js_peek(s);
+    if (c == '"')
     {
-        cJSON_Delete(root);
+        return js_string(s, NULL);
+    }
+    if (c == '{' || c == '[')
+    {
+        int depth = 0;
+        while (s->p < s->end)
+        {
+            char ch = *s->p;
+            if (ch == '"')
+            {
+                if (js_string(s, NULL) < 0)
+                {
+                    return -1;
+                }
+                continue;
+            }
+            if (ch == '{' || ch == '[')
+            {
+                depth++;
+            }
+            else if (ch == '}' || ch == ']')
+            {
+                if (--depth == 0)
+                {
+                    s->p++;
+                    return 0;
+                }
+            }
+            s->p++;
+        }
+        return -1;
+    }
+    /* Number or literal */
+    const char* start = s->p;
+    while (s->p < s->end && *s->p != ',' && *s->p != '}' && *s->p != ']' && *s->p != ' ' && *s->p != '\t'
+        && *s->p != '\n' && *s->p != '\r')
+    {
+        s->p++;
+    }
+    return s->p > start ? 0 : -1;
+}
+
+/* Container iteration: js_begin() consumes the opening bracket, then
+ * js_next() (arrays) or js_member() (objects) returns 1 per element, 0 at
+ * the closing bracket and -1 on error. On 1 the scanner is positioned at the
+ * value, which the caller must consume; js_member() also returns the raw key. */
+static int js_begin(json_scan_t* s, char open)
+{
+    if (js_peek(s) != open)
+    {
+        return -1;
+    }
+    s->p++;
+    return 0;
+}
+
+static int js_next(json_scan_t* s, char close)
+{
+    int c = js_peek(s);
+    if (c == close)
+    {
+        s->p++;
         return 0;
     }
+    if (c == ',')
+    {
+        s->p++;
+    }
+    else if (c < 0)
+    {
+        return -1;
+    }
+    return 1;
+}
 
-    /* Content */
-    cJSON* content = cJSON_GetObjectItem(delta, "content");
-    if (cJSON_IsString(content))
+static int js_member(json_scan_t* s, const char** key, size_t* klen)
+{
+    int r = js_next(s, '}');
+    if (r <= 0)
+    {
+        return r;
+    }
+    if (js_peek(s) != '"')
+    {
+        return -1;
+    }
+    s->p++;
+    int escaped;
+    const char* close = js_string_end(s, &escaped);
+    if (!close)
     {
-        out->content = strdup(content->valuestring);
+        return -1;
+    }
+    *key = s->p;
+    *klen = (size_t)(close - s->p);
+    s->p = close + 1;
+    if (js_peek(s) != ':')
+    {
+        return -1;
     }
+    s->p++;
+    return 1;
+}
+
+#define KEY_IS(k, kl, lit) ((kl) == sizeof(lit) - 1 && memcmp((k), (lit), sizeof(lit) - 1) == 0)
+
+/* Read a string member into *off, or skip it if it is not a string. */
+static int js_string_or_skip(json_scan_t* s, size_t* off)
+{
+    return js_peek(s) == '"' ? js_string(s, off) : js_skip(s);
+}
 
-    /* Reasoning content (OpenAI: "reasoning_content", Ollama: "reasoning") */
-    cJSON* reasoning = cJSON_GetObjectItem(delta, "reasoning_content");
-    if (!reasoning)
+static int scan_usage(json_scan_t* s, delta_t* out)
+{
+    if (js_peek(s) != '{')
     {
-        reasoning = cJSON_GetObjectItem(delta, "reasoning");
+        return js_skip(s);
     }
-    if (cJSON_IsString(reasoning))
+    js_begin(s, '{');
+    const char* k;
+    size_t kl;
+    int r;
+    while ((r = js_member(s, &k, &kl)) > 0)
     {
-        out->reasoning_content = strdup(reasoning->valuestring);
+        int c = js_peek(s);
+        int is_num = c == '-' || (c >= '0' && c <= '9');
+        if (is_num && KEY_IS(k, kl, "prompt_tokens"))
+        {
+            r = js_int(s, &out->input_tokens);
+        }
+        else if (is_num && KEY_IS(k, kl, "completion_tokens"))
+        {
+            r = js_int(s, &out->output_tokens);
+        }
+        else
+        {
+            r = js_skip(s);
+        }
+        if (r < 0)
+        {
+            return -1;
+        }
     }
+    return r;
+}
 
-    /* Tool calls */
-    cJSON* tcs = cJSON_GetObjectItem(delta, "tool_calls");
-    if (tcs && cJSON_GetArraySize(tcs) > 0)
+static int scan_function(json_scan_t* s, delta_offs_t* o)
+{
+    if (js_peek(s) != '{')
+    {
+        return js_skip(s);
+    }
+    js_begin(s, '{');
+    const char* k;
+    size_t kl;
+    int r;
+    while ((r = js_member(s, &k, &kl)) > 0)
     {
-        cJSON* tc = cJSON_GetArrayItem(tcs, 0);
-        cJSON* idx = cJSON_GetObjectItem(tc, "index");
-        if (idx && cJSON_IsNumber(idx))
+        if (KEY_IS(k, kl, "name"))
+        {
+            r = js_string_or_skip(s, &o->tc_name);
+        }
+        else if (KEY_IS(k, kl, "arguments"))
+        {
+            r = js_string_or_skip(s, &o->tc_arguments);
+        }
+        else
+        {
+            r = js_skip(s);
+        }
+        if (r < 0)
         {
-            out->tool_call_index = idx->valueint;
+            return -1;
         }
+    }
+    return r;
+}
 
-        cJSON* id = cJSON_GetObjectItem(tc, "id");
-        if (cJSON_IsString(id))
+static int scan_tool_calls(json_scan_t* s, delta_t* out, delta_offs_t* o)
+{
+    if (js_peek(s) != '[')
+    {
+        return js_skip(s);
+    }
+    js_begin(s, '[');
+    int r;
+    int i = 0;
+    while ((r = js_next(s, ']')) > 0)
+    {
+        /* Only the first tool call of a delta is reported */
+        if (i++ > 0 || js_peek(s) != '{')
+        {
+            if (js_skip(s) < 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+        js_begin(s, '{');
+        const char* k;
+        size_t kl;
+        while ((r = js_member(s, &k, &kl)) > 0)
         {
-            out->tc_id = strdup(id->valuestring);
+            int c = js_peek(s);
+            if (KEY_IS(k, kl, "index") && (c == '-' || (c >= '0' && c <= '9')))
+            {
+                r = js_int(s, &out->tool_call_index);
+            }
+            else if (KEY_IS(k, kl, "id"))
+            {
+                r = js_string_or_skip(s, &o->tc_id);
+            }
+            else if (KEY_IS(k, kl, "function"))
+            {
+                r = scan_function(s, o);
+            }
+            else
+            {
+                r = js_skip(s);
+            }
+            if (r < 0)
+            {
+                return -1;
+            }
         }
+        if (r < 0)
+        {
+            return -1;
+        }
+    }
+    return r;
+}
+
+static int scan_delta(json_scan_t* s, delta_t* out, delta_offs_t* o)
+{
+    if (js_peek(s) != '{')
+    {
+        return js_skip(s);
+    }
+    js_begin(s, '{');
+    const char* k;
+    size_t kl;
+    int r;
+    while ((r = js_member(s, &k, &kl)) > 0)
+    {
+        if (KEY_IS(k, kl, "content"))
+        {
+            r = js_string_or_skip(s, &o->content);
+        }
+        /* Reasoning content (OpenAI: "reasoning_content", Ollama: "reasoning") */
+        else if (KEY_IS(k, kl, "reasoning_content"))
+        {
+            r = js_string_or_skip(s, &o->reasoning_content);
+        }
+        else if (KEY_IS(k, kl, "reasoning"))
+        {
+            r = js_string_or_skip(s, &o->reasoning);
+        }
+        else if (KEY_IS(k, kl, "tool_calls"))
+        {
+            r = scan_tool_calls(s, out, o);
+        }
+        else
+        {
+            r = js_skip(s);
+        }
+        if (r < 0)
+        {
+            return -1;
+        }
+    }
+    return r;
+}
 
-        cJSON* fn = cJSON_GetObjectItem(tc, "function");
-        if (fn)
+static int scan_choices(json_scan_t* s, delta_t* out, delta_offs_t* o)
+{
+    if (js_peek(s) != '[')
+    {
+        return js_skip(s);
+    }
+    js_begin(s, '[');
+    int r;
+    int i = 0;
+    while ((r = js_next(s, ']')) > 0)
+    {
+        if (i++ > 0 || js_peek(s) != '{')
         {
-            cJSON* name = cJSON_GetObjectItem(fn, "name");
-            cJSON* args = cJSON_GetObjectItem(fn, "arguments");
-            if (cJSON_IsString(name))
+            if (js_skip(s) < 0)
             {
-                out->tc_name = strdup(name->valuestring);
+                return -1;
             }
-            if (cJSON_IsString(args))
+            continue;
+        }
+        js_begin(s, '{');
+        const char* k;
+        size_t kl;
+        while ((r = js_member(s, &k, &kl)) > 0)
+        {
+            r = KEY_IS(k, kl, "delta") ? scan_delta(s, out, o) : js_skip(s);
+            if (r < 0)
             {
-                out->tc_arguments = strdup(args->valuestring);
+                return -1;
             }
         }
+        if (r < 0)
+        {
+            return -1;
+        }
     }
+    return r;
+}
 
-    cJSON_Delete(root);
-    return 0;
+static const char* scratch_str(buf_t* scratch, size_t off)
+{
+    return off == NO_STR ? NULL : scratch->data + off;
 }
 
-void delta_free(delta_t* d)
+int api_parse_delta(const char* json, size_t len, buf_t* scratch, delta_t* out)
 {
-    free(d->content);
-    free(d->reasoning_content);
-    free(d->tc_id);
-    free(d->tc_name);
-    free(d->tc_arguments);
-    memset(d, 0, sizeof(*d));
-    d->tool_call_index = -1;
+    memset(out, 0, sizeof(*out));
+    out->tool_call_index = -1;
+    buf_clear(scratch);
+
+    json_scan_t s = { .p = json, .end = json + len, .scratch = scratch };
+    delta_offs_t o = { NO_STR, NO_STR, NO_STR, NO_STR, NO_STR, NO_STR };
+
+    if (js_begin(&s, '{') < 0)
+    {
+        return -1;
+    }
+    const char* k;
+    size_t kl;
+    int r;
+    while ((r = js_member(&s, &k, &kl)) > 0)
+    {
+        /* Usage (usually on last chunk) */
+        if (KEY_IS(k, kl, "usage"))
+        {
+            r = scan_usage(&s, out);
+        }
+        else if (KEY_IS(k, kl, "choices"))
+        {
+            r = scan_choices(&s, out, &o);
+        }
+        else
+        {
+            r = js_skip(&s);
+        }
+        if (r < 0)
+        {
+            return -1;
+        }
+    }
+    if (r < 0 || js_peek(&s) >= 0)
+    {
+        return -1;
+    }
+
+    out->content = scratch_str(scratch, o.content);
+    out->reasoning_content = scratch_str(scratch, o.reasoning_content != NO_STR ? o.reasoning_content : o.reasoning);
+    out->tc_id = scratch_str(scratch, o.tc_id);
+    out->tc_name = scratch_str(scratch, o.tc_name);
+    out->tc_arguments = scratch_str(scratch, o.tc_arguments);
+    return 0;
 }
@@ -1,31 +1,37 @@
 #ifndef API_H
 #define API_H
 
-#include <cJSON.h>
+#include "buf.h"
+#include "rope.h"
+
 #include <stddef.h>
 
-/* A single parsed SSE delta chunk. */
+/* A single parsed SSE delta chunk. String fields are NUL-terminated views
+ * into the scratch buffer passed to api_parse_delta() and stay valid until
+ * the next call with the same buffer. */
 typedef struct
 {
-    char* content; /* text delta (may be NULL) */
-    char* reasoning_content; /* reasoning/thinking delta (may be NULL) */
+    const char* content; /* text delta (may be NULL) */
+    const char* reasoning_content; /* reasoning/thinking delta (may be NULL) */
     int tool_call_index; /* -1 if no tool call in this chunk */
-    char* tc_id; /* tool call ID fragment */
-    char* tc_name; /* function name fragment */
-    char* tc_arguments; /* arguments JSON fragment */
+    const char* tc_id; /* tool call ID fragment */
+    const char* tc_name; /* function name fragment */
+    const char* tc_arguments; /* arguments JSON fragment */
     int input_tokens; /* from usage (0 if not present) */
     int output_tokens;
 } delta_t;
 
-/* Build the chat completions request body as a JSON string.
- * messages is a cJSON array. tools is a cJSON array or NULL.
- * Caller must free the returned string. */
-char* api_build_request(const char* model, cJSON* messages, cJSON* tools);
+/* Append the chat completions request body to rope body.
+ * messages_json holds the already-serialized messages joined by commas,
+ * without the enclosing brackets. tools_json is a serialized tools array
+ * or NULL. Both are referenced, not copied, and must outlive the rope. */
+void api_build_request(rope_t* body, const char* model, const char* messages_json, size_t messages_len,
+                       const char* tools_json);
 
-/* Parse one SSE JSON chunk into a delta_t.
+/* Parse one SSE JSON chunk into a delta_t without building a JSON tree.
+ * Only choices[0].delta and usage are extracted; strings are unescaped into
+ * scratch, which is cleared first and can be reused across calls.
  * Returns 0 on success, -1 on parse error. */
-int api_parse_delta(const char* json, size_t len, delta_t* out);
-
-void delta_free(delta_t* d);
+int api_parse_delta(const char* json, size_t len, buf_t* scratch, delta_t* out);
 
 #endif
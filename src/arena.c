@@ -0,0 +1,113 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN alignof(max_align_t)
+
+void arena_init(arena_t* a) { memset(a, 0, sizeof(*a)); }
+
+static void arena_free_blocks(arena_block_t* b)
+{
+    while (b)
+    {
+        arena_block_t* next = b->next;
+        free(b->data);
+        free(b);
+        b = next;
+    }
+}
+
+void arena_free(arena_t* a)
+{
+    arena_free_blocks(a->head);
+    a->head = NULL;
+    a->last = NULL;
+    a->last_size = 0;
+}
+
+void arena_reset(arena_t* a)
+{
+    if (a->head)
+    {
+        /* Blocks double in size, so the head is the largest: keep it */
+        arena_free_blocks(a->head->next);
+        a->head->next = NULL;
+        a->head->used = 0;
+    }
+    a->last = NULL;
+    a->last_size = 0;
+}
+
+static arena_block_t* arena_new_block(arena_t* a, size_t need)
+{
+    size_t cap = a->head ? a->head->cap * 2 : ARENA_BLOCK_SIZE;
+    while (cap < need)
+    {
+        cap *= 2;
+    }
+    arena_block_t* b = malloc(sizeof(*b));
+    char* data = malloc(cap);
+    if (!b || !data)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    b->data = data;
+    b->cap = cap;
+    b->used = 0;
+    b->next = a->head;
+    a->head = b;
+    return b;
+}
+
+void* arena_alloc(arena_t* a, size_t size)
+{
+    a->allocs++;
+    if (size == 0)
+    {
+        size = 1;
+    }
+    arena_block_t* b = a->head;
+    size_t off = b ? (b->used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1) : 0;
+    if (!b || off + size > b->cap)
+    {
+        b = arena_new_block(a, size);
+        off = 0;
+    }
+    else
+    {
+        a->avoided++;
+    }
+    b->used = off + size;
+    a->last = b->data + off;
+    a->last_size = size;
+    return a->last;
+}
+
+void* arena_grow(arena_t* a, void* p, size_t old_size, size_t new_size)
+{
+    if (!p)
+    {
+        return arena_alloc(a, new_size);
+    }
+    if (new_size <= old_size)
+    {
+        return p;
+    }
+    arena_block_t* b = a->head;
+    if (p == a->last && (char*)p + new_size <= b->data + b->cap)
+    {
+        a->allocs++;
+        a->avoided++;
+        b->used = (size_t)((char*)p - b->data) + new_size;
+        a->last_size = new_size;
+        return p;
+    }
+    void* q = arena_alloc(a, new_size);
+    memcpy(q, p, old_size);
+    return q;
+}
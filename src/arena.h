@@ -0,0 +1,40 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Bump allocator for memory that dies together, e.g. everything transient in
+ * one agent_send(). Individual allocations are never freed; arena_reset()
+ * releases them all at once and keeps the largest block for reuse, so a
+ * steady-state turn performs no malloc at all. */
+
+typedef struct arena_block
+{
+    struct arena_block* next;
+    size_t cap;
+    size_t used;
+    char* data;
+} arena_block_t;
+
+typedef struct arena
+{
+    arena_block_t* head; /* block currently allocated from */
+    void* last; /* most recent allocation (may grow in place) */
+    size_t last_size;
+    unsigned long allocs; /* allocation requests served, lifetime */
+    unsigned long avoided; /* of those, served without calling malloc */
+} arena_t;
+
+void arena_init(arena_t* a);
+void arena_free(arena_t* a);
+
+/* Release every allocation. Memory is kept for the next round. */
+void arena_reset(arena_t* a);
+
+/* Allocate size bytes, aligned for any type. Never returns NULL. */
+void* arena_alloc(arena_t* a, size_t size);
+
+/* realloc() equivalent. Grows in place when p is the latest allocation. */
+void* arena_grow(arena_t* a, void* p, size_t old_size, size_t new_size);
+
+#endif
@@ -0,0 +1,267 @@
+/* artd: optional background daemon that keeps provider connections warm.
+ *
+ * art forwards each chat completions request over a Unix socket (see
+ * daemon.h); artd performs it on a pooled curl handle for that base_url and
+ * API key, keeping TCP and TLS connections alive between invocations, and
+ * relays the raw response stream back. Everything else, including tools
+ * and approvals, stays in the art process. */
+
+#include "arena.h"
+#include "daemon.h"
+#include "http.h"
+#include "rope.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* One curl handle per concurrent request; idle ones are reused by the
+ * next request for the same endpoint and credentials. */
+typedef struct pooled
+{
+    http_client_t http;
+    int busy;
+    struct pooled* next;
+} pooled_t;
+
+static pooled_t* g_pool = NULL;
+static pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t g_stop = 0;
+
+static int same(const char* a, const char* b) { return strcmp(a ? a : "", b ? b : "") == 0; }
+
+static pooled_t* pool_acquire(const char* base_url, const char* api_key)
+{
+    pthread_mutex_lock(&g_pool_lock);
+    for (pooled_t* p = g_pool; p; p = p->next)
+    {
+        if (!p->busy && same(p->http.base_url, base_url) && same(p->http.api_key, api_key))
+        {
+            p->busy = 1;
+            pthread_mutex_unlock(&g_pool_lock);
+            return p;
+        }
+    }
+    pthread_mutex_unlock(&g_pool_lock);
+
+    pooled_t* p = calloc(1, sizeof(*p));
+    if (!p)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    if (http_init(&p->http, base_url, api_key) < 0)
+    {
+        free(p);
+        return NULL;
+    }
+    p->busy = 1;
+
+    pthread_mutex_lock(&g_pool_lock);
+    p->next = g_pool;
+    g_pool = p;
+    pthread_mutex_unlock(&g_pool_lock);
+    return p;
+}
+
+static void pool_release(pooled_t* p)
+{
+    pthread_mutex_lock(&g_pool_lock);
+    p->busy = 0;
+    pthread_mutex_unlock(&g_pool_lock);
+}
+
+/* Free idle handles, saving their connection caches. Busy ones still
+ * belong to their threads and go away with the process. */
+static void pool_free(void)
+{
+    pthread_mutex_lock(&g_pool_lock);
+    pooled_t** link = &g_pool;
+    while (*link)
+    {
+        pooled_t* p = *link;
+        if (p->busy)
+        {
+            link = &p->next;
+            continue;
+        }
+        *link = p->next;
+        http_free(&p->http);
+        free(p);
+    }
+    pthread_mutex_unlock(&g_pool_lock);
+}
+
+/* Relay response bytes; a failed write means the client went away, and
+ * returning 0 makes curl abort the upstream transfer. */
+static size_t relay_data(const char* data, size_t len, void* userdata)
+{
+    int fd = *(int*)userdata;
+    return daemon_write_frame(fd, DAEMON_FRAME_DATA, data, len) == 0 ? len : 0;
+}
+
+static void* serve_client(void* arg)
+{
+    int fd = (int)(intptr_t)arg;
+    daemon_request_t req;
+    if (daemon_read_request(fd, &req) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    long http_code = 0;
+    char errbuf[512] = { 0 };
+    int ret = -1;
+    pooled_t* p = pool_acquire(req.base_url, req.api_key);
+    if (!p)
+    {
+        snprintf(errbuf, sizeof(errbuf), "artd: failed to initialize HTTP client");
+    }
+    else
+    {
+        arena_t arena;
+        arena_init(&arena);
+        rope_t body;
+        rope_init(&body, &arena);
+        rope_ref(&body, req.body.data, req.body.len);
+        ret = http_post_stream(&p->http, &body, relay_data, &fd, &http_code, errbuf, sizeof(errbuf));
+        arena_free(&arena);
+        pool_release(p);
+    }
+
+    char end[600];
+    int n = snprintf(end, sizeof(end), "%d %ld %s", ret, http_code, errbuf);
+    daemon_write_frame(fd, DAEMON_FRAME_END, end, (size_t)n < sizeof(end) ? (size_t)n : sizeof(end) - 1);
+
+    daemon_request_free(&req);
+    close(fd);
+    return NULL;
+}
+
+static void on_stop_signal(int sig)
+{
+    (void)sig;
+    g_stop = 1;
+}
+
+static int listen_socket(const char* path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "artd: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    /* A stale socket from a dead daemon is replaced; a live one wins */
+    if (daemon_available())
+    {
+        fprintf(stderr, "artd: already running on %s\n", path);
+        return -1;
+    }
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror("artd: socket");
+        return -1;
+    }
+    /* Requests carry API keys: only the owner may connect */
+    mode_t old = umask(077);
+    int r = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old);
+    if (r < 0 || listen(fd, 64) < 0)
+    {
+        fprintf(stderr, "artd: cannot listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        fprintf(stderr,
+            "Usage: artd\n"
+            "\n"
+            "Keep provider connections warm for art. Listens on $ARTD_SOCKET,\n"
+            "or ~/.artifice/artd.sock. Stop with SIGINT or SIGTERM.\n");
+        return strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0 ? 0 : 1;
+    }
+
+    char* path = daemon_socket_path();
+    if (!path)
+    {
+        fprintf(stderr, "artd: cannot determine HOME\n");
+        return 1;
+    }
+    char* dir = strdup(path);
+    char* slash = dir ? strrchr(dir, '/') : NULL;
+    if (slash && slash != dir)
+    {
+        *slash = '\0';
+        mkdir(dir, 0755);
+    }
+    free(dir);
+
+    int lfd = listen_socket(path);
+    if (lfd < 0)
+    {
+        free(path);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop_signal; /* no SA_RESTART: accept() must return */
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    while (!g_stop)
+    {
+        int cfd = accept(lfd, NULL, NULL);
+        if (cfd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            perror("artd: accept");
+            break;
+        }
+        pthread_t t;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&t, &attr, serve_client, (void*)(intptr_t)cfd) != 0)
+        {
+            close(cfd);
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    close(lfd);
+    unlink(path);
+    free(path);
+    pool_free();
+    curl_global_cleanup();
+    return 0;
+}
@@ -0,0 +1,237 @@
+#include "balance.h"
+#include "util.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define BALANCE_MAGIC 0x61727468u /* "arth" */
+#define BALANCE_VERSION 2
+#define BALANCE_SLOTS 256
+#define BALANCE_URL_MAX 208
+
+/* Requests one process has in flight to an endpoint */
+typedef struct
+{
+    int32_t pid; /* 0 = free */
+    uint32_t count;
+} health_owner_t;
+
+/* One endpoint's health; 320 bytes. Times are wall-clock milliseconds so
+ * every process agrees on them. */
+typedef struct
+{
+    char url[BALANCE_URL_MAX]; /* "" = free slot; longer URLs are truncated */
+    uint32_t failures; /* consecutive */
+    uint32_t reserved0;
+    int64_t ewma_us; /* 0 = no sample yet */
+    int64_t open_until_ms; /* circuit open until then */
+    int64_t updated_ms;
+    health_owner_t owners[BALANCE_OWNERS];
+    int64_t reserved[2];
+} health_slot_t;
+
+struct balance_table
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t reserved;
+    health_slot_t slots[BALANCE_SLOTS];
+};
+
+/* Find url's slot, claiming a free one (or the least recently used) if it
+ * has none. Called with the table locked. */
+static health_slot_t* slot_for(balancer_t* b, const char* url)
+{
+    int found;
+    health_slot_t* s = state_slot(b->table->slots, BALANCE_SLOTS, sizeof(health_slot_t), BALANCE_URL_MAX,
+        offsetof(health_slot_t, updated_ms), url, &found);
+    if (!found)
+    {
+        memset(s, 0, sizeof(*s));
+        snprintf(s->url, sizeof(s->url), "%s", url);
+        s->updated_ms = state_now_ms();
+    }
+    return s;
+}
+
+/* Drop the counts of processes that have exited, and return the rest's
+ * total. Called with the table locked. */
+static uint32_t in_flight(health_slot_t* s)
+{
+    uint32_t total = 0;
+    for (int k = 0; k < BALANCE_OWNERS; k++)
+    {
+        health_owner_t* o = &s->owners[k];
+        if (o->pid && kill((pid_t)o->pid, 0) < 0 && errno == ESRCH)
+        {
+            o->pid = 0;
+            o->count = 0;
+        }
+        total += o->count;
+    }
+    return total;
+}
+
+/* This process's entry in s, claiming a free one if needed. NULL if all
+ * are taken; such requests are not counted rather than left behind. */
+static health_owner_t* owner_for(health_slot_t* s, int claim)
+{
+    int32_t pid = (int32_t)getpid();
+    health_owner_t* free_owner = NULL;
+    for (int k = 0; k < BALANCE_OWNERS; k++)
+    {
+        if (s->owners[k].pid == pid)
+        {
+            return &s->owners[k];
+        }
+        if (!s->owners[k].pid && !free_owner)
+        {
+            free_owner = &s->owners[k];
+        }
+    }
+    if (claim && free_owner)
+    {
+        free_owner->pid = pid;
+        free_owner->count = 0;
+    }
+    return claim ? free_owner : NULL;
+}
+
+void balance_init(balancer_t* b, char** urls)
+{
+    memset(b, 0, sizeof(*b));
+    b->urls = urls;
+    while (urls && urls[b->count])
+    {
+        b->count++;
+    }
+    b->table_len = sizeof(struct balance_table);
+    b->table = map_state_file("/.artifice/cache/health", b->table_len, &b->fd);
+    pthread_mutex_init(&b->lock, NULL);
+
+    state_lock(&b->lock, b->fd);
+    if (b->table->magic != BALANCE_MAGIC || b->table->version != BALANCE_VERSION)
+    {
+        memset(b->table, 0, b->table_len);
+        b->table->magic = BALANCE_MAGIC;
+        b->table->version = BALANCE_VERSION;
+    }
+    state_unlock(&b->lock, b->fd);
+}
+
+void balance_free(balancer_t* b)
+{
+    if (b->table)
+    {
+        munmap(b->table, b->table_len);
+    }
+    if (b->fd >= 0)
+    {
+        close(b->fd);
+    }
+    pthread_mutex_destroy(&b->lock);
+    memset(b, 0, sizeof(*b));
+    b->fd = -1;
+}
+
+int balance_acquire(balancer_t* b, const char* tried)
+{
+    state_lock(&b->lock, b->fd);
+    int64_t now = state_now_ms();
+    int best = -1;
+    double best_score = 0;
+    int fallback = -1; /* open circuit closest to reopening */
+    int64_t fallback_until = 0;
+    unsigned first = b->rotor++;
+    for (int n = 0; n < b->count; n++)
+    {
+        int i = (int)((first + (unsigned)n) % (unsigned)b->count);
+        if (tried && tried[i])
+        {
+            continue;
+        }
+        health_slot_t* s = slot_for(b, b->urls[i]);
+        uint32_t busy = in_flight(s);
+        if (s->open_until_ms > now)
+        {
+            if (fallback < 0 || s->open_until_ms < fallback_until)
+            {
+                fallback = i;
+                fallback_until = s->open_until_ms;
+            }
+            continue;
+        }
+        /* Unmeasured endpoints score lowest, so each gets probed */
+        double score = (double)(s->ewma_us > 0 ? s->ewma_us : 1) * (double)(busy + 1);
+        if (best < 0 || score < best_score)
+        {
+            best = i;
+            best_score = score;
+        }
+    }
+    if (best < 0)
+    {
+        best = fallback;
+    }
+    if (best >= 0)
+    {
+        health_slot_t* s = slot_for(b, b->urls[best]);
+        health_owner_t* o = owner_for(s, 1);
+        if (o)
+        {
+            o->count++;
+        }
+        s->updated_ms = now;
+    }
+    state_unlock(&b->lock, b->fd);
+    return best;
+}
+
+void balance_release(balancer_t* b, int index, balance_outcome_t outcome, long first_event_ms)
+{
+    if (index < 0 || index >= b->count)
+    {
+        return;
+    }
+    state_lock(&b->lock, b->fd);
+    int64_t now = state_now_ms();
+    health_slot_t* s = slot_for(b, b->urls[index]);
+    health_owner_t* o = owner_for(s, 0);
+    if (o && o->count > 0 && --o->count == 0)
+    {
+        o->pid = 0;
+    }
+    s->updated_ms = now;
+    if (outcome == BALANCE_OK)
+    {
+        int64_t sample = (int64_t)first_event_ms * 1000;
+        s->ewma_us = s->ewma_us > 0 ? (s->ewma_us * 7 + sample * 3) / 10 : (sample > 0 ? sample : 1);
+        s->failures = 0;
+        s->open_until_ms = 0;
+    }
+    else if (outcome == BALANCE_FAILED)
+    {
+        s->failures++;
+        if (s->failures >= BALANCE_TRIP)
+        {
+            int64_t cooldown = BALANCE_COOLDOWN_MS;
+            for (uint32_t n = BALANCE_TRIP; n < s->failures && cooldown < BALANCE_COOLDOWN_MAX_MS; n++)
+            {
+                cooldown *= 2;
+            }
+            if (cooldown > BALANCE_COOLDOWN_MAX_MS)
+            {
+                cooldown = BALANCE_COOLDOWN_MAX_MS;
+            }
+            s->open_until_ms = now + cooldown;
+        }
+    }
+    state_unlock(&b->lock, b->fd);
+}
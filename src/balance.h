@@ -0,0 +1,59 @@
+#ifndef BALANCE_H
+#define BALANCE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* Client-side load balancing across replicas of one agent's endpoint.
+ *
+ * Every base_url has a health record: an EWMA of the time to the first
+ * streamed event, the number of requests in flight, and a circuit breaker
+ * that opens after BALANCE_TRIP consecutive failures (transport errors and
+ * 5xx) and stays open for a cooldown that doubles with each further failure.
+ * Records live in ~/.artifice/cache/health, mmap'd shared, so concurrent
+ * art processes on the host balance against each other's load. In-flight
+ * counts are kept per process id, and those of processes that have exited
+ * without releasing them are dropped on the next acquire. */
+
+#define BALANCE_TRIP 3 /* consecutive failures that open the circuit */
+#define BALANCE_COOLDOWN_MS 5000 /* first open period */
+#define BALANCE_COOLDOWN_MAX_MS (5 * 60 * 1000)
+#define BALANCE_OWNERS 8 /* processes whose in-flight requests one endpoint tracks */
+
+typedef enum
+{
+    BALANCE_OK,
+    BALANCE_FAILED,
+    BALANCE_NONE, /* no verdict on the endpoint, e.g. interrupted or a 4xx */
+} balance_outcome_t;
+
+struct balance_table;
+
+typedef struct balancer
+{
+    char** urls; /* NULL-terminated, borrowed */
+    int count;
+    struct balance_table* table;
+    size_t table_len;
+    int fd; /* lock file descriptor, -1 if the table is private */
+    pthread_mutex_t lock; /* flock does not exclude threads sharing fd */
+    unsigned rotor; /* spreads ties between equally good endpoints */
+} balancer_t;
+
+/* Map the shared health table, falling back to private memory if it cannot
+ * be opened. urls must outlive b. */
+void balance_init(balancer_t* b, char** urls);
+void balance_free(balancer_t* b);
+
+/* Choose the endpoint with the lowest EWMA x (in-flight + 1) among those
+ * with a closed circuit, skipping any whose tried[i] is set (tried may be
+ * NULL). If every circuit is open, the one closest to reopening is chosen.
+ * Counts the request as in flight. Returns the index into urls, or -1 if
+ * all were tried. */
+int balance_acquire(balancer_t* b, const char* tried);
+
+/* Finish a request started by balance_acquire(). first_event_ms is the
+ * latency sample for BALANCE_OK. */
+void balance_release(balancer_t* b, int index, balance_outcome_t outcome, long first_event_ms);
+
+#endif
@@ -0,0 +1,422 @@
+#include "batch.h"
+#include "agent.h"
+#include "balance.h"
+#include "buf.h"
+#include "engine.h"
+#include "http.h"
+#include "json.h"
+#include "limit.h"
+#include "policy.h"
+#include "runner.h"
+#include "util.h"
+
+#include <cJSON.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct
+{
+    const char* line; /* the record, NUL-terminated inside batch_t.input */
+    char* output; /* finished result line, until written */
+} batch_item_t;
+
+typedef struct
+{
+    const config_t* cfg;
+    const batch_opts_t* opts;
+    http_engine_t engine;
+    policy_t policy; /* shared by all records */
+    buf_t input;
+    batch_item_t* items;
+    int count;
+
+    pthread_mutex_t lock; /* guards everything below, and stdout */
+    int next; /* next record to start */
+    int written; /* records written so far, in input order mode */
+    int failed;
+} batch_t;
+
+static const char* string_field(const cJSON* rec, const char* name)
+{
+    const cJSON* item = cJSON_GetObjectItemCaseSensitive(rec, name);
+    return cJSON_IsString(item) ? item->valuestring : NULL;
+}
+
+static long elapsed_ms(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* Attachments first, then the prompt, as on the command line. */
+static int build_message(const cJSON* rec, const char* prompt, buf_t* msg, char* errbuf, size_t errlen)
+{
+    const cJSON* files = cJSON_GetObjectItemCaseSensitive(rec, "attachments");
+    if (files && !cJSON_IsArray(files))
+    {
+        snprintf(errbuf, errlen, "\"attachments\" must be an array of paths");
+        return -1;
+    }
+    int count = cJSON_GetArraySize(files);
+    char** paths = calloc((size_t)count + 1, sizeof(char*));
+    if (!paths)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    int n = 0;
+    const cJSON* f;
+    cJSON_ArrayForEach(f, files)
+    {
+        if (!cJSON_IsString(f))
+        {
+            free(paths);
+            snprintf(errbuf, errlen, "\"attachments\" must be an array of paths");
+            return -1;
+        }
+        paths[n++] = f->valuestring;
+    }
+
+    const char* failed = NULL;
+    int ret = append_attachments(msg, paths, n, &failed);
+    free(paths);
+    if (ret < 0)
+    {
+        snprintf(errbuf, errlen, "Error reading %s", failed);
+        return -1;
+    }
+    buf_append_str(msg, prompt);
+    return 0;
+}
+
+/* Run one record through the agent loop. Returns 0, or -1 with errbuf set. */
+static int run_record(batch_t* b, const cJSON* rec, const char* agent_name, loop_result_t* result, char* errbuf,
+    size_t errlen)
+{
+    const batch_opts_t* o = b->opts;
+    const char* prompt = string_field(rec, "prompt");
+    if (!prompt)
+    {
+        snprintf(errbuf, errlen, "record has no \"prompt\" string");
+        return -1;
+    }
+
+    resolved_agent_t ra;
+    if (resolve_agent(b->cfg, agent_name, &ra, errbuf, errlen) < 0)
+    {
+        return -1;
+    }
+
+    int ret = -1;
+    buf_t msg = { 0 };
+    if (ra.provider && strcmp(ra.provider, "copilot") == 0)
+    {
+        snprintf(errbuf, errlen, "copilot agents are not supported in batch mode");
+    }
+    else if (build_message(rec, prompt, &msg, errbuf, errlen) == 0)
+    {
+        const char* system_prompt = string_field(rec, "system_prompt");
+        if (!system_prompt)
+        {
+            system_prompt = o->system_prompt ? o->system_prompt : ra.system_prompt;
+        }
+        const char* base_url = ra.base_url && ra.base_url[0] ? ra.base_url : DEFAULT_BASE_URL;
+
+        http_client_t http;
+        http_init_engine(&http, base_url, ra.api_key, &b->engine);
+        http.retries = b->cfg->retries;
+        http.flags = agent_http_flags(&ra);
+        balancer_t balance;
+        if (ra.base_urls)
+        {
+            balance_init(&balance, ra.base_urls);
+            http.balance = &balance;
+        }
+        limiter_t limit;
+        int limited = ra.rpm > 0 || ra.tpm > 0 || ra.api_keys;
+        if (limited)
+        {
+            limit_init(&limit, ra.name, ra.api_keys, ra.api_key, ra.rpm, ra.tpm);
+            http.limit = &limit;
+        }
+        agent_hedge_t hedge;
+        memset(&hedge, 0, sizeof(hedge));
+        if (ra.hedge_count > 1)
+        {
+            agent_hedge_init(&hedge, &ra, &b->engine);
+        }
+        agent_t agent;
+        agent_init(&agent, &http, ra.model, system_prompt, o->tool_patterns);
+        agent.hedge = hedge.count > 1 ? &hedge : NULL;
+
+        ret = run_agent_loop(
+            &agent, msg.data, NULL, NULL, NULL, NULL, NULL, &b->policy, b->cfg->tool_workers,
+            (const char**)b->cfg->tool_serial, b->cfg->shell_session, 0, result);
+        if (ret < 0 || result->error)
+        {
+            snprintf(errbuf, errlen, "%s", result->error && result->error[0] ? result->error : "interrupted");
+            ret = -1;
+        }
+
+        agent_free(&agent);
+        agent_hedge_free(&hedge);
+        http_free(&http);
+        if (ra.base_urls)
+        {
+            balance_free(&balance);
+        }
+        if (limited)
+        {
+            limit_free(&limit);
+        }
+    }
+    buf_free(&msg);
+    resolved_agent_free(&ra);
+    return ret;
+}
+
+/* Run record index and return its result line. */
+static char* run_item(batch_t* b, int index, int* ok)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    char errbuf[512];
+    errbuf[0] = '\0';
+    loop_result_t result;
+    memset(&result, 0, sizeof(result));
+
+    cJSON* rec = cJSON_Parse(b->items[index].line);
+    const char* agent_name = NULL;
+    if (!cJSON_IsObject(rec))
+    {
+        snprintf(errbuf, sizeof(errbuf), "invalid JSON record");
+        *ok = 0;
+    }
+    else
+    {
+        agent_name = string_field(rec, "agent");
+        if (!agent_name)
+        {
+            agent_name = b->opts->agent;
+        }
+        *ok = run_record(b, rec, agent_name, &result, errbuf, sizeof(errbuf)) == 0;
+    }
+    if (!agent_name)
+    {
+        agent_name = b->cfg->agent;
+    }
+
+    buf_t out = { 0 };
+    json_writer_t w;
+    jw_init(&w, &out);
+    jw_object_begin(&w);
+    jw_key(&w, "index");
+    jw_int(&w, index);
+    jw_key(&w, "id");
+    const cJSON* id = cJSON_GetObjectItemCaseSensitive(rec, "id");
+    if (id)
+    {
+        jw_cjson(&w, id);
+    }
+    else
+    {
+        jw_null(&w);
+    }
+    jw_key(&w, "agent");
+    jw_string(&w, agent_name);
+    jw_key(&w, "ok");
+    jw_bool(&w, *ok);
+    jw_key(&w, "text");
+    jw_string(&w, result.text);
+    jw_key(&w, "error");
+    jw_string(&w, *ok ? NULL : errbuf);
+    jw_key(&w, "usage");
+    jw_object_begin(&w);
+    jw_key(&w, "input_tokens");
+    jw_int(&w, result.input_tokens);
+    jw_key(&w, "output_tokens");
+    jw_int(&w, result.output_tokens);
+    jw_object_end(&w);
+    jw_key(&w, "elapsed_ms");
+    jw_int(&w, elapsed_ms(&start));
+    jw_object_end(&w);
+    buf_append_str(&out, "\n");
+
+    loop_result_free(&result);
+    cJSON_Delete(rec);
+    return buf_detach(&out);
+}
+
+/* Called with b->lock held. */
+static void emit(batch_t* b, int index, char* line)
+{
+    if (b->opts->completion_order)
+    {
+        fputs(line, stdout);
+        fflush(stdout);
+        free(line);
+        return;
+    }
+    b->items[index].output = line;
+    while (b->written < b->count && b->items[b->written].output)
+    {
+        fputs(b->items[b->written].output, stdout);
+        free(b->items[b->written].output);
+        b->items[b->written].output = NULL;
+        b->written++;
+    }
+    fflush(stdout);
+}
+
+static void* batch_worker(void* arg)
+{
+    batch_t* b = arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&b->lock);
+        int index = g_http_interrupted ? b->count : b->next++;
+        pthread_mutex_unlock(&b->lock);
+        if (index >= b->count)
+        {
+            break;
+        }
+
+        int ok = 0;
+        char* line = run_item(b, index, &ok);
+
+        pthread_mutex_lock(&b->lock);
+        if (!ok)
+        {
+            b->failed++;
+        }
+        emit(b, index, line);
+        pthread_mutex_unlock(&b->lock);
+    }
+    return NULL;
+}
+
+static int read_input(batch_t* b, const char* path, char* errbuf, size_t errlen)
+{
+    if (strcmp(path, "-") == 0)
+    {
+        for (;;)
+        {
+            buf_reserve(&b->input, 64 * 1024);
+            size_t n = fread(b->input.data + b->input.len, 1, b->input.cap - b->input.len - 1, stdin);
+            if (n == 0)
+            {
+                break;
+            }
+            b->input.len += n;
+            b->input.data[b->input.len] = '\0';
+        }
+    }
+    else if (read_file_append(&b->input, path) < 0)
+    {
+        snprintf(errbuf, errlen, "Cannot read %s", path);
+        return -1;
+    }
+
+    /* Split into lines in place; blank lines are skipped */
+    int cap = 0;
+    char* save = NULL;
+    for (char* line = b->input.data ? strtok_r(b->input.data, "\n", &save) : NULL; line;
+         line = strtok_r(NULL, "\n", &save))
+    {
+        if (line[strspn(line, " \t\r")] == '\0')
+        {
+            continue;
+        }
+        if (b->count >= cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            batch_item_t* tmp = realloc(b->items, (size_t)cap * sizeof(*tmp));
+            if (!tmp)
+            {
+                fprintf(stderr, "Out of memory\n");
+                exit(1);
+            }
+            b->items = tmp;
+        }
+        b->items[b->count].line = line;
+        b->items[b->count].output = NULL;
+        b->count++;
+    }
+    return 0;
+}
+
+int run_batch(const config_t* cfg, const batch_opts_t* opts, char* errbuf, size_t errlen)
+{
+    const char* mode = opts->tool_approval ? opts->tool_approval : "ask";
+    if (opts->tool_patterns && opts->tool_patterns[0] && strcmp(mode, "auto") != 0 && strcmp(mode, "deny") != 0)
+    {
+        snprintf(errbuf, errlen, "--batch with --tools needs --tool-approval auto or deny");
+        return -1;
+    }
+
+    batch_t b;
+    memset(&b, 0, sizeof(b));
+    b.cfg = cfg;
+    b.opts = opts;
+    if (policy_init(&b.policy, mode, opts->tool_allowlist, cfg->tool_policy, cfg->tool_policy_count, errbuf, errlen) < 0)
+    {
+        return -1;
+    }
+    if (read_input(&b, opts->path, errbuf, errlen) < 0)
+    {
+        policy_free(&b.policy);
+        buf_free(&b.input);
+        return -1;
+    }
+    if (http_engine_init(&b.engine) < 0)
+    {
+        snprintf(errbuf, errlen, "Failed to start HTTP engine");
+        policy_free(&b.policy);
+        buf_free(&b.input);
+        free(b.items);
+        return -1;
+    }
+    b.engine.stall_ms = cfg->stall_timeout * 1000;
+    pthread_mutex_init(&b.lock, NULL);
+
+    int workers = opts->concurrency < b.count ? opts->concurrency : b.count;
+    pthread_t* threads = calloc((size_t)(workers > 0 ? workers : 1), sizeof(pthread_t));
+    if (!threads)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    int started = 0;
+    for (int i = 0; i < workers; i++)
+    {
+        if (pthread_create(&threads[started], NULL, batch_worker, &b) == 0)
+        {
+            started++;
+        }
+    }
+    if (started == 0 && b.count > 0)
+    {
+        batch_worker(&b);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    http_engine_free(&b.engine);
+    policy_free(&b.policy);
+    pthread_mutex_destroy(&b.lock);
+    for (int i = 0; i < b.count; i++)
+    {
+        free(b.items[i].output);
+    }
+    free(b.items);
+    buf_free(&b.input);
+    return b.failed ? 1 : 0;
+}
@@ -0,0 +1,34 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "config.h"
+
+/* Batch mode: run every record of a JSONL file as an independent prompt,
+ * several at once over shared connections, and write one JSONL result per
+ * record to stdout.
+ *
+ * Input records:  {"prompt": "...", "id": any, "agent": "name",
+ *                  "attachments": ["path", ...], "system_prompt": "..."}
+ * Output records: {"index": n, "id": any, "agent": "name", "ok": bool,
+ *                  "text": "...", "error": "..." | null,
+ *                  "usage": {"input_tokens": n, "output_tokens": n},
+ *                  "elapsed_ms": n}
+ * Only "prompt" is required. */
+
+typedef struct
+{
+    const char* path; /* input file, "-" for stdin */
+    int concurrency; /* records in flight at once */
+    int completion_order; /* write results as they finish, not in input order */
+    const char* agent; /* for records without "agent"; NULL = default */
+    const char* system_prompt; /* for records without "system_prompt"; NULL = the agent's */
+    char** tool_patterns; /* NULL-terminated, or NULL for no tools */
+    const char* tool_approval; /* must be "auto" or "deny" if tools are enabled */
+    const char** tool_allowlist;
+} batch_opts_t;
+
+/* Run the batch. Returns 0 if every record succeeded, 1 if any failed, or
+ * -1 if the batch could not run at all (errbuf set). */
+int run_batch(const config_t* cfg, const batch_opts_t* opts, char* errbuf, size_t errlen);
+
+#endif
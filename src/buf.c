@@ -1,4 +1,5 @@
 #include "buf.h"
+#include "arena.h"
 
 #include <stdarg.h>
 #include <stdio.h>
@@ -12,6 +13,13 @@ void buf_init(buf_t* b)
     b->data = NULL;
     b->len = 0;
     b->cap = 0;
+    b->arena = NULL;
+}
+
+void buf_init_arena(buf_t* b, struct arena* a)
+{
+    buf_init(b);
+    b->arena = a;
 }
 
 static void buf_grow(buf_t* b, size_t need)
@@ -25,6 +33,12 @@ static void buf_grow(buf_t* b, size_t need)
     {
         cap *= 2;
     }
+    if (b->arena)
+    {
+        b->data = arena_grow(b->arena, b->data, b->cap, cap);
+        b->cap = cap;
+        return;
+    }
     b->data = realloc(b->data, cap);
     if (!b->data)
     {
@@ -34,6 +48,9 @@ static void buf_grow(buf_t* b, size_t need)
     b->cap = cap;
 }
 
+/* Make room for at least extra more bytes without further reallocation. */
+void buf_reserve(buf_t* b, size_t extra) { buf_grow(b, extra); }
+
 void buf_append(buf_t* b, const char* s, size_t len)
 {
     if (!len)
@@ -87,7 +104,10 @@ void buf_clear(buf_t* b)
 
 void buf_free(buf_t* b)
 {
-    free(b->data);
+    if (!b->arena)
+    {
+        free(b->data);
+    }
     b->data = NULL;
     b->len = 0;
     b->cap = 0;
@@ -96,6 +116,16 @@ void buf_free(buf_t* b)
 char* buf_detach(buf_t* b)
 {
     char* s = b->data;
+    if (b->arena && s)
+    {
+        s = malloc(b->len + 1);
+        if (!s)
+        {
+            fprintf(stderr, "out of memory\n");
+            abort();
+        }
+        memcpy(s, b->data, b->len + 1);
+    }
     b->data = NULL;
     b->len = 0;
     b->cap = 0;
@@ -3,14 +3,21 @@
 
 #include <stddef.h>
 
+struct arena;
+
 typedef struct
 {
     char* data;
     size_t len;
     size_t cap;
+    struct arena* arena; /* if set, storage comes from this arena */
 } buf_t;
 
 void buf_init(buf_t* b);
+/* Like buf_init, but allocate from arena a. buf_free is then a no-op and
+ * buf_detach returns a malloc'd copy, so the result outlives the arena. */
+void buf_init_arena(buf_t* b, struct arena* a);
+void buf_reserve(buf_t* b, size_t extra);
 void buf_append(buf_t* b, const char* s, size_t len);
 void buf_append_str(buf_t* b, const char* s);
 void buf_printf(buf_t* b, const char* fmt, ...);
@@ -37,6 +37,173 @@ static char** parse_string_list(yaml_document_t* doc, yaml_node_t* seq)
     return list;
 }
 
+/* A scalar as a one-element list, or a sequence as a list. */
+static char** parse_string_or_list(yaml_document_t* doc, yaml_node_t* n)
+{
+    if (n && n->type == YAML_SCALAR_NODE)
+    {
+        char** list = calloc(2, sizeof(char*));
+        if (!list)
+        {
+            return NULL;
+        }
+        list[0] = strdup((const char*)n->data.scalar.value);
+        return list;
+    }
+    return parse_string_list(doc, n);
+}
+
+static void policy_rule_def_free(policy_rule_def_t* r)
+{
+    free_string_list(r->tools);
+    free_string_list(r->paths);
+    free(r->command);
+    free(r->scope);
+}
+
+/* Parse a tool_policy sequence, appending to the rules of earlier files so
+ * a project's rules add to the user's. */
+static void parse_tool_policy(yaml_document_t* doc, yaml_node_t* seq, config_t* cfg)
+{
+    yaml_node_item_t* item;
+    for (item = seq->data.sequence.items.start; item < seq->data.sequence.items.top; item++)
+    {
+        yaml_node_t* map = yaml_document_get_node(doc, *item);
+        if (!map || map->type != YAML_MAPPING_NODE)
+        {
+            continue;
+        }
+        policy_rule_def_t* tmp = realloc(cfg->tool_policy, (size_t)(cfg->tool_policy_count + 1) * sizeof(*tmp));
+        if (!tmp)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        cfg->tool_policy = tmp;
+        policy_rule_def_t* r = &cfg->tool_policy[cfg->tool_policy_count++];
+        memset(r, 0, sizeof(*r));
+        r->allow = -1;
+
+        yaml_node_pair_t* pair;
+        for (pair = map->data.mapping.pairs.start; pair < map->data.mapping.pairs.top; pair++)
+        {
+            yaml_node_t* key = yaml_document_get_node(doc, pair->key);
+            yaml_node_t* val = yaml_document_get_node(doc, pair->value);
+            if (!key || key->type != YAML_SCALAR_NODE || !val)
+            {
+                continue;
+            }
+            const char* k = (const char*)key->data.scalar.value;
+            if (strcmp(k, "allow") == 0 || strcmp(k, "deny") == 0)
+            {
+                int allow = strcmp(k, "allow") == 0;
+                r->allow = r->tools ? -1 : allow;
+                if (!r->tools)
+                {
+                    r->tools = parse_string_or_list(doc, val);
+                }
+            }
+            else if (strcmp(k, "path") == 0)
+            {
+                free_string_list(r->paths);
+                r->paths = parse_string_or_list(doc, val);
+            }
+            else if (strcmp(k, "command") == 0 && val->type == YAML_SCALAR_NODE)
+            {
+                free(r->command);
+                r->command = strdup((const char*)val->data.scalar.value);
+            }
+            else if (strcmp(k, "scope") == 0 && val->type == YAML_SCALAR_NODE)
+            {
+                free(r->scope);
+                r->scope = strdup((const char*)val->data.scalar.value);
+            }
+        }
+    }
+}
+
+static void agent_def_free(agent_def_t* a)
+{
+    free(a->name);
+    free(a->model);
+    free(a->api_key);
+    free_string_list(a->api_keys);
+    free(a->api_key_env);
+    free_string_list(a->api_key_envs);
+    free(a->provider);
+    free(a->base_url);
+    free_string_list(a->base_urls);
+    free(a->system_prompt);
+    free_string_list(a->tools);
+    free_string_list(a->hedge);
+    free(a->compress_request);
+}
+
+static char** dup_string_list(char** list)
+{
+    if (!list)
+    {
+        return NULL;
+    }
+    int count = 0;
+    while (list[count])
+    {
+        count++;
+    }
+    char** copy = calloc((size_t)count + 1, sizeof(char*));
+    if (!copy)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        copy[i] = xstrdup(list[i]);
+    }
+    return copy;
+}
+
+/* Collect the keys to rotate across: the literal list, else whichever of
+ * the listed variables are set. Only set when there are two or more. */
+static void resolve_api_keys(const agent_def_t* def, resolved_agent_t* out)
+{
+    char** keys = dup_string_list(def->api_keys);
+    if (!keys && !def->api_key && def->api_key_envs)
+    {
+        int count = 0;
+        while (def->api_key_envs[count])
+        {
+            count++;
+        }
+        keys = calloc((size_t)count + 1, sizeof(char*));
+        if (!keys)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        int n = 0;
+        for (int i = 0; i < count; i++)
+        {
+            const char* env = getenv(def->api_key_envs[i]);
+            if (env && env[0])
+            {
+                keys[n++] = xstrdup(env);
+            }
+        }
+        /* The first listed variable may be unset */
+        if (n > 0 && !out->api_key)
+        {
+            out->api_key = xstrdup(keys[0]);
+        }
+    }
+    if (keys && (!keys[0] || !keys[1]))
+    {
+        free_string_list(keys);
+        keys = NULL;
+    }
+    out->api_keys = keys;
+}
+
 /* Parse an agent definition from a YAML mapping node. */
 static void parse_agent_def(yaml_document_t* doc, yaml_node_t* map, agent_def_t* a)
 {
@@ -65,12 +232,16 @@ static void parse_agent_def(yaml_document_t* doc, yaml_node_t* map, agent_def_t*
             else if (strcmp(k, "api_key") == 0)
             {
                 free(a->api_key);
+                free_string_list(a->api_keys);
                 a->api_key = strdup(v);
+                a->api_keys = NULL;
             }
             else if (strcmp(k, "api_key_env") == 0)
             {
                 free(a->api_key_env);
+                free_string_list(a->api_key_envs);
                 a->api_key_env = strdup(v);
+                a->api_key_envs = NULL;
             }
             else if (strcmp(k, "provider") == 0)
             {
@@ -80,13 +251,36 @@ static void parse_agent_def(yaml_document_t* doc, yaml_node_t* map, agent_def_t*
             else if (strcmp(k, "base_url") == 0)
             {
                 free(a->base_url);
+                free_string_list(a->base_urls);
                 a->base_url = strdup(v);
+                a->base_urls = NULL;
             }
             else if (strcmp(k, "system_prompt") == 0)
             {
                 free(a->system_prompt);
                 a->system_prompt = strdup(v);
             }
+            else if (strcmp(k, "hedge_delay_ms") == 0)
+            {
+                a->hedge_delay_ms = strtol(v, NULL, 10);
+            }
+            else if (strcmp(k, "rpm") == 0)
+            {
+                a->rpm = strtol(v, NULL, 10);
+            }
+            else if (strcmp(k, "tpm") == 0)
+            {
+                a->tpm = strtol(v, NULL, 10);
+            }
+            else if (strcmp(k, "compress_request") == 0)
+            {
+                free(a->compress_request);
+                a->compress_request = strdup(v);
+            }
+            else if (strcmp(k, "compress_response") == 0)
+            {
+                a->compress_response = (strcmp(v, "false") != 0 && strcmp(v, "0") != 0);
+            }
         }
         else if (val && val->type == YAML_SEQUENCE_NODE)
         {
@@ -95,6 +289,32 @@ static void parse_agent_def(yaml_document_t* doc, yaml_node_t* map, agent_def_t*
                 free_string_list(a->tools);
                 a->tools = parse_string_list(doc, val);
             }
+            else if (strcmp(k, "hedge") == 0)
+            {
+                free_string_list(a->hedge);
+                a->hedge = parse_string_list(doc, val);
+            }
+            else if (strcmp(k, "base_url") == 0)
+            {
+                free(a->base_url);
+                free_string_list(a->base_urls);
+                a->base_urls = parse_string_list(doc, val);
+                a->base_url = a->base_urls ? xstrdup(a->base_urls[0]) : NULL;
+            }
+            else if (strcmp(k, "api_key") == 0)
+            {
+                free(a->api_key);
+                free_string_list(a->api_keys);
+                a->api_keys = parse_string_list(doc, val);
+                a->api_key = a->api_keys ? xstrdup(a->api_keys[0]) : NULL;
+            }
+            else if (strcmp(k, "api_key_env") == 0)
+            {
+                free(a->api_key_env);
+                free_string_list(a->api_key_envs);
+                a->api_key_envs = parse_string_list(doc, val);
+                a->api_key_env = a->api_key_envs ? xstrdup(a->api_key_envs[0]) : NULL;
+            }
         }
     }
 }
@@ -195,6 +415,25 @@ static int load_config_file(const char* path, config_t* cfg, char* errbuf, size_
             {
                 cfg->save_session = (strcmp(v, "false") != 0 && strcmp(v, "0") != 0);
             }
+            else if (strcmp(k, "shell_session") == 0)
+            {
+                cfg->shell_session = (strcmp(v, "false") != 0 && strcmp(v, "0") != 0);
+            }
+            else if (strcmp(k, "retries") == 0)
+            {
+                long n = strtol(v, NULL, 10);
+                cfg->retries = n < 0 ? 0 : (int)(n > 10 ? 10 : n);
+            }
+            else if (strcmp(k, "stall_timeout") == 0)
+            {
+                long n = strtol(v, NULL, 10);
+                cfg->stall_timeout = n < 0 ? 0 : n;
+            }
+            else if (strcmp(k, "tool_workers") == 0)
+            {
+                long n = strtol(v, NULL, 10);
+                cfg->tool_workers = n < 1 ? 1 : (int)(n > 64 ? 64 : n);
+            }
             else if (strcmp(k, "system_prompt") == 0)
             {
                 free(cfg->system_prompt);
@@ -208,14 +447,7 @@ static int load_config_file(const char* path, config_t* cfg, char* errbuf, size_
                 /* Free any existing agents from a previous config file */
                 for (int i = 0; i < cfg->agent_count; i++)
                 {
-                    free(cfg->agents[i].name);
-                    free(cfg->agents[i].model);
-                    free(cfg->agents[i].api_key);
-                    free(cfg->agents[i].api_key_env);
-                    free(cfg->agents[i].provider);
-                    free(cfg->agents[i].base_url);
-                    free(cfg->agents[i].system_prompt);
-                    free_string_list(cfg->agents[i].tools);
+                    agent_def_free(&cfg->agents[i]);
                 }
                 free(cfg->agents);
                 cfg->agents = NULL;
@@ -230,6 +462,15 @@ static int load_config_file(const char* path, config_t* cfg, char* errbuf, size_
                 free_string_list(cfg->tool_allowlist);
                 cfg->tool_allowlist = parse_string_list(&doc, val);
             }
+            else if (strcmp(k, "tool_serial") == 0)
+            {
+                free_string_list(cfg->tool_serial);
+                cfg->tool_serial = parse_string_list(&doc, val);
+            }
+            else if (strcmp(k, "tool_policy") == 0)
+            {
+                parse_tool_policy(&doc, val, cfg);
+            }
         }
     }
 
@@ -244,6 +485,9 @@ int config_load(config_t* cfg, char* errbuf, size_t errlen)
 {
     memset(cfg, 0, sizeof(*cfg));
     cfg->save_session = 1;
+    cfg->retries = DEFAULT_RETRIES;
+    cfg->stall_timeout = DEFAULT_STALL_TIMEOUT;
+    cfg->tool_workers = DEFAULT_TOOL_WORKERS;
 
     char* home_cfg = home_path("/.artifice/config.yaml");
     if (home_cfg)
@@ -270,6 +514,18 @@ int config_load(config_t* cfg, char* errbuf, size_t errlen)
         cfg->tool_approval = strdup("ask");
     }
 
+    /* Shell commands can touch anything, so by default they run alone */
+    if (!cfg->tool_serial)
+    {
+        cfg->tool_serial = calloc(2, sizeof(char*));
+        if (!cfg->tool_serial)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        cfg->tool_serial[0] = xstrdup("shell");
+    }
+
     return 0;
 }
 
@@ -278,22 +534,82 @@ void config_free(config_t* cfg)
     free(cfg->agent);
     for (int i = 0; i < cfg->agent_count; i++)
     {
-        agent_def_t* a = &cfg->agents[i];
-        free(a->name);
-        free(a->model);
-        free(a->api_key);
-        free(a->api_key_env);
-        free(a->provider);
-        free(a->base_url);
-        free(a->system_prompt);
-        free_string_list(a->tools);
+        agent_def_free(&cfg->agents[i]);
     }
     free(cfg->agents);
     free(cfg->tool_approval);
     free_string_list(cfg->tool_allowlist);
+    free_string_list(cfg->tool_serial);
+    for (int i = 0; i < cfg->tool_policy_count; i++)
+    {
+        policy_rule_def_free(&cfg->tool_policy[i]);
+    }
+    free(cfg->tool_policy);
     free(cfg->system_prompt);
 }
 
+static const agent_def_t* find_agent_def(const config_t* cfg, const char* name)
+{
+    for (int i = 0; i < cfg->agent_count; i++)
+    {
+        if (strcmp(cfg->agents[i].name, name) == 0)
+        {
+            return &cfg->agents[i];
+        }
+    }
+    return NULL;
+}
+
+/* Resolve each member of a hedged agent; the agent itself takes on the
+ * settings of the first one. */
+static int resolve_hedge(const config_t* cfg, const agent_def_t* def, resolved_agent_t* out, char* errbuf,
+    size_t errlen)
+{
+    int count = 0;
+    while (def->hedge[count])
+    {
+        count++;
+    }
+    out->hedge = calloc((size_t)count, sizeof(resolved_agent_t));
+    if (!out->hedge)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        const agent_def_t* md = find_agent_def(cfg, def->hedge[i]);
+        if (md && md->hedge && md->hedge[0])
+        {
+            snprintf(errbuf, errlen, "Agent '%s': hedge member '%s' is itself hedged", def->name, md->name);
+            resolved_agent_free(out);
+            return -1;
+        }
+        resolved_agent_t* m = &out->hedge[i];
+        if (resolve_agent(cfg, def->hedge[i], m, errbuf, errlen) < 0)
+        {
+            resolved_agent_free(out);
+            return -1;
+        }
+        out->hedge_count++;
+        if (m->provider && strcmp(m->provider, "copilot") == 0)
+        {
+            snprintf(errbuf, errlen, "Agent '%s': copilot agent '%s' cannot be hedged", def->name, m->name);
+            resolved_agent_free(out);
+            return -1;
+        }
+    }
+
+    const resolved_agent_t* first = &out->hedge[0];
+    out->model = xstrdup(first->model);
+    out->api_key = xstrdup(first->api_key);
+    out->provider = xstrdup(first->provider);
+    out->base_url = xstrdup(first->base_url);
+    out->system_prompt = xstrdup(def->system_prompt ? def->system_prompt : first->system_prompt);
+    out->hedge_delay_ms = def->hedge_delay_ms > 0 ? def->hedge_delay_ms : DEFAULT_HEDGE_DELAY_MS;
+    return 0;
+}
+
 int resolve_agent(const config_t* cfg, const char* name, resolved_agent_t* out, char* errbuf, size_t errlen)
 {
     memset(out, 0, sizeof(*out));
@@ -305,23 +621,23 @@ int resolve_agent(const config_t* cfg, const char* name, resolved_agent_t* out,
         return -1;
     }
 
-    agent_def_t* def = NULL;
-    for (int i = 0; i < cfg->agent_count; i++)
-    {
-        if (strcmp(cfg->agents[i].name, agent_name) == 0)
-        {
-            def = &cfg->agents[i];
-            break;
-        }
-    }
+    const agent_def_t* def = find_agent_def(cfg, agent_name);
     if (!def)
     {
         snprintf(errbuf, errlen, "Unknown agent: '%s'", agent_name);
         return -1;
     }
 
+    out->name = xstrdup(def->name);
+    if (def->hedge && def->hedge[0])
+    {
+        return resolve_hedge(cfg, def, out, errbuf, errlen);
+    }
+
     if (!def->model)
     {
+        free(out->name);
+        out->name = NULL;
         snprintf(errbuf, errlen, "Agent '%s' has no model defined", agent_name);
         return -1;
     }
@@ -338,9 +654,27 @@ int resolve_agent(const config_t* cfg, const char* name, resolved_agent_t* out,
             out->api_key = strdup(env);
         }
     }
+    resolve_api_keys(def, out);
+    out->rpm = def->rpm;
+    out->tpm = def->tpm;
+
+    const char* coding = def->compress_request;
+    if (coding && strcmp(coding, "none") != 0 && strcmp(coding, "gzip") != 0)
+    {
+        snprintf(errbuf, errlen, "Agent '%s': unsupported compress_request '%s' (use gzip or none)", agent_name,
+            coding);
+        resolved_agent_free(out);
+        return -1;
+    }
+    out->gzip_request = coding && strcmp(coding, "gzip") == 0;
+    out->compress_response = def->compress_response;
 
     out->provider = xstrdup(def->provider);
     out->base_url = xstrdup(def->base_url);
+    if (def->base_urls && def->base_urls[0] && def->base_urls[1])
+    {
+        out->base_urls = dup_string_list(def->base_urls);
+    }
     out->system_prompt = xstrdup(def->system_prompt);
     if (!out->system_prompt)
     {
@@ -352,11 +686,20 @@ int resolve_agent(const config_t* cfg, const char* name, resolved_agent_t* out,
 
 void resolved_agent_free(resolved_agent_t* ra)
 {
+    for (int i = 0; i < ra->hedge_count; i++)
+    {
+        resolved_agent_free(&ra->hedge[i]);
+    }
+    free(ra->hedge);
+    free(ra->name);
     free(ra->model);
     free(ra->api_key);
+    free_string_list(ra->api_keys);
     free(ra->provider);
     free(ra->base_url);
+    free_string_list(ra->base_urls);
     free(ra->system_prompt);
+    memset(ra, 0, sizeof(*ra));
 }
 
 int config_set_agent(const char* name)
@@ -3,18 +3,52 @@
 
 #include <stddef.h>
 
+/* base_url of agents that do not set one */
+#define DEFAULT_BASE_URL "https://api.openai.com/v1"
+
+/* Wait before starting the next member of a hedged agent */
+#define DEFAULT_HEDGE_DELAY_MS 1000
+
+/* Retries of a request that failed before producing output */
+#define DEFAULT_RETRIES 2
+
+/* Tool calls of one turn run at once */
+#define DEFAULT_TOOL_WORKERS 4
+
+/* Seconds without a byte from the server before a stream is abandoned */
+#define DEFAULT_STALL_TIMEOUT 90
+
 typedef struct
 {
     char* name;
     char* model;
-    char* api_key;
+    char* api_key; /* the first, if a list was given */
+    char** api_keys; /* NULL-terminated keys to rotate across */
     char* api_key_env;
+    char** api_key_envs; /* NULL-terminated, when api_key_env is a list */
     char* provider;
-    char* base_url;
+    char* base_url; /* the first, if a list was given */
+    char** base_urls; /* NULL-terminated replicas when base_url is a list */
     char* system_prompt;
     char** tools; /* NULL-terminated */
+    char** hedge; /* NULL-terminated agents to race, or NULL */
+    long hedge_delay_ms; /* 0 = DEFAULT_HEDGE_DELAY_MS */
+    long rpm; /* requests per minute, 0 = unlimited */
+    long tpm; /* tokens per minute, 0 = unlimited */
+    char* compress_request; /* "gzip" or "none", NULL = none */
+    int compress_response; /* ask for a compressed response stream */
 } agent_def_t;
 
+/* One entry of tool_policy as written; compiled by policy_init() */
+typedef struct
+{
+    int allow; /* 1 = allow, 0 = deny, -1 = neither or both given */
+    char** tools; /* NULL-terminated fnmatch patterns */
+    char** paths; /* NULL-terminated path prefixes, or NULL for any */
+    char* command; /* extended regex over a "command" argument, or NULL */
+    char* scope; /* directory the rule is limited to, or NULL */
+} policy_rule_def_t;
+
 typedef struct
 {
     char* agent;
@@ -24,19 +58,40 @@ typedef struct
 
     char* tool_approval; /* "ask", "auto", "deny" */
     char** tool_allowlist; /* NULL-terminated */
+    int tool_workers; /* tool calls of a turn run at once; default DEFAULT_TOOL_WORKERS */
+    char** tool_serial; /* NULL-terminated patterns of tools that run alone; default shell */
+    policy_rule_def_t* tool_policy; /* rules of every config file, in load order */
+    int tool_policy_count;
+    int shell_session; /* shell commands of a run share one shell; default 0 */
 
     int save_session; /* default 1 */
+    int retries; /* default DEFAULT_RETRIES */
+    long stall_timeout; /* seconds, 0 = never; default DEFAULT_STALL_TIMEOUT */
 
     char* system_prompt;
 } config_t;
 
-typedef struct
+typedef struct resolved_agent
 {
+    char* name;
     char* model;
     char* api_key;
+    char** api_keys; /* NULL-terminated, when requests rotate across keys */
     char* provider;
     char* base_url;
+    char** base_urls; /* NULL-terminated, when requests are balanced across replicas */
     char* system_prompt;
+    long rpm;
+    long tpm;
+    int gzip_request; /* send request bodies gzip'd */
+    int compress_response;
+
+    /* Members of a hedged agent, in launch order. The fields above are then
+     * those of the first member, except system_prompt if the hedged agent
+     * sets its own. */
+    struct resolved_agent* hedge;
+    int hedge_count;
+    long hedge_delay_ms;
 } resolved_agent_t;
 
 /* Load config from ~/.artifice/config.yaml and ./.artifice/config.yaml.
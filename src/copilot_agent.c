@@ -1,10 +1,11 @@
 #include "copilot_agent.h"
 #include "buf.h"
 #include "copilot.h"
+#include "policy.h"
+#include "shell.h"
 #include "tools.h"
 
 #include <cJSON.h>
-#include <fnmatch.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,138 +14,6 @@
 /* Shared interrupted flag (from main.c via http.h) */
 extern volatile sig_atomic_t g_http_interrupted;
 
-/* ---- Tool Approver (duplicated from runner.c — keep in sync) ---- */
-
-typedef struct
-{
-    const char* mode;
-    const char** allowlist;
-    char** always_allowed;
-    int always_count;
-    int always_cap;
-} cp_approver_t;
-
-static void cp_approver_init(cp_approver_t* ap, const char* mode, const char** allowlist)
-{
-    ap->mode = mode ? mode : "ask";
-    ap->allowlist = allowlist;
-    ap->always_allowed = NULL;
-    ap->always_count = 0;
-    ap->always_cap = 0;
-}
-
-static void cp_approver_free(cp_approver_t* ap)
-{
-    for (int i = 0; i < ap->always_count; i++)
-    {
-        free(ap->always_allowed[i]);
-    }
-    free(ap->always_allowed);
-}
-
-static int cp_approver_is_allowed(cp_approver_t* ap, const char* name)
-{
-    if (strcmp(ap->mode, "auto") == 0)
-    {
-        return 1;
-    }
-    if (strcmp(ap->mode, "deny") == 0)
-    {
-        return 0;
-    }
-
-    if (ap->allowlist)
-    {
-        for (const char** p = ap->allowlist; *p; p++)
-        {
-            if (fnmatch(*p, name, 0) == 0)
-            {
-                return 1;
-            }
-        }
-    }
-
-    for (int i = 0; i < ap->always_count; i++)
-    {
-        if (strcmp(ap->always_allowed[i], name) == 0)
-        {
-            return 1;
-        }
-    }
-
-    return 0;
-}
-
-static void cp_approver_add_always(cp_approver_t* ap, const char* name)
-{
-    if (ap->always_count >= ap->always_cap)
-    {
-        ap->always_cap = ap->always_cap ? ap->always_cap * 2 : 4;
-        char** tmp = realloc(ap->always_allowed, (size_t)ap->always_cap * sizeof(char*));
-        if (!tmp)
-        {
-            fprintf(stderr, "Out of memory\n");
-            exit(1);
-        }
-        ap->always_allowed = tmp;
-    }
-    ap->always_allowed[ap->always_count++] = strdup(name);
-}
-
-/* Returns: 1 = allowed, 0 = denied. */
-static int cp_approver_check(cp_approver_t* ap, const char* name, const char* args_json)
-{
-    if (cp_approver_is_allowed(ap, name))
-    {
-        return 1;
-    }
-
-    /* Interactive approval */
-    fprintf(stderr, "\nTool Call: %s\n", name);
-    if (args_json)
-    {
-        fprintf(stderr, "   Arguments: %s\n", args_json);
-    }
-
-    while (1)
-    {
-        fprintf(stderr, "\nApprove this tool call? [Y]es [N]o [A]lways: ");
-        fflush(stderr);
-
-        char line[64];
-        if (!fgets(line, sizeof(line), stdin))
-        {
-            return 0;
-        }
-
-        char* p = line;
-        while (*p == ' ' || *p == '\t')
-        {
-            p++;
-        }
-        char c = *p;
-        if (c >= 'A' && c <= 'Z')
-        {
-            c += 32;
-        }
-
-        if (c == 'y')
-        {
-            return 1;
-        }
-        if (c == 'n')
-        {
-            return 0;
-        }
-        if (c == 'a')
-        {
-            cp_approver_add_always(ap, name);
-            return 1;
-        }
-        fprintf(stderr, "Invalid response. Please enter Y, N, or A.\n");
-    }
-}
-
 /* ---- Callback context ---- */
 
 typedef struct
@@ -157,7 +26,8 @@ typedef struct
     turn_fn on_turn_end;
 
     /* Tool approval */
-    cp_approver_t approver;
+    policy_t* policy;
+    tool_ctx_t tools;
     int tool_output;
 
     /* Accumulated result */
@@ -180,10 +50,12 @@ static char* copilot_tool_handler(const char* name, const char* args_json, void*
 
     fprintf(stderr, "\n");
 
-    int allowed = cp_approver_check(&ctx->approver, name, args_json);
+    cJSON* args = cJSON_Parse(args_json);
+    int allowed = policy_check(ctx->policy, name, args, NULL);
 
     if (!allowed)
     {
+        cJSON_Delete(args);
         buf_t denied = { 0 };
         buf_printf(&denied, "Tool call %s was denied by user", name);
         fprintf(stderr, "%s() → denied\n", name);
@@ -196,9 +68,6 @@ static char* copilot_tool_handler(const char* name, const char* args_json, void*
         return buf_detach(&denied);
     }
 
-    /* Parse args JSON into cJSON for tools_execute */
-    cJSON* args = cJSON_Parse(args_json);
-
     /* Display tool call */
     fprintf(stderr, "%s(", name);
     if (args)
@@ -236,7 +105,7 @@ static char* copilot_tool_handler(const char* name, const char* args_json, void*
     }
     fprintf(stderr, ")");
 
-    char* result = tools_execute(name, args);
+    char* result = tools_execute(name, args, &ctx->tools);
     cJSON_Delete(args);
 
     if (!result)
@@ -348,8 +217,7 @@ static void copilot_event_handler(copilot_event_type type, const char* data_json
 
 int run_copilot_agent(const char* model, const char* system_prompt,
     const char* prompt, char** tool_patterns,
-    const char* tool_approval, const char** tool_allowlist,
-    int tool_output,
+    policy_t* policy, int shell_session, int tool_output,
     chunk_fn on_chunk, chunk_fn on_reasoning_chunk, void* on_chunk_data,
     turn_fn on_turn_start, turn_fn on_turn_end,
     copilot_result_t* out)
@@ -366,7 +234,10 @@ int run_copilot_agent(const char* model, const char* system_prompt,
     ctx.on_turn_start = on_turn_start;
     ctx.on_turn_end = on_turn_end;
     ctx.tool_output = tool_output;
-    cp_approver_init(&ctx.approver, tool_approval, tool_allowlist);
+    ctx.policy = policy;
+    shell_session_t shell;
+    shell_session_init(&shell);
+    ctx.tools.shell = shell_session ? &shell : NULL;
 
     /* Create and start client */
     copilot_client_t* client = copilot_client_create();
@@ -396,30 +267,16 @@ int run_copilot_agent(const char* model, const char* system_prompt,
     /* Register tools matching patterns */
     if (tool_patterns)
     {
-        tools_init();
-
-        cJSON* schemas = tools_get_schemas((const char**)tool_patterns);
-        int count = cJSON_GetArraySize(schemas);
+        int count;
+        const tool_def_t* defs = tools_list(&count);
         for (int i = 0; i < count; i++)
         {
-            cJSON* schema = cJSON_GetArrayItem(schemas, i);
-            cJSON* fn = cJSON_GetObjectItem(schema, "function");
-            if (!fn)
+            if (tools_match(&defs[i], (const char**)tool_patterns))
             {
-                continue;
+                copilot_session_register_tool(session, defs[i].name, defs[i].description, defs[i].parameters,
+                    copilot_tool_handler, &ctx);
             }
-
-            const char* name = cJSON_GetObjectItem(fn, "name")->valuestring;
-            const char* desc = cJSON_GetObjectItem(fn, "description")->valuestring;
-            cJSON* params = cJSON_GetObjectItem(fn, "parameters");
-            char* params_json = params ? cJSON_PrintUnformatted(params) : NULL;
-
-            copilot_session_register_tool(session, name, desc, params_json,
-                copilot_tool_handler, &ctx);
-
-            free(params_json);
         }
-        cJSON_Delete(schemas);
     }
 
     /* Start spinner for the first model turn */
@@ -468,7 +325,7 @@ cleanup_ctx:
     out->text = buf_detach(&ctx.text);
     out->interrupted = g_http_interrupted;
     free(ctx.error);
-    cp_approver_free(&ctx.approver);
+    shell_session_free(&shell);
     return ret;
 }
 
@@ -10,12 +10,12 @@ typedef struct
     int interrupted; /* set if SIGINT */
 } copilot_result_t;
 
-/* Run a copilot session with tool support.
+/* Run a copilot session with tool support, tool calls decided by policy.
+ * With shell_session, shell commands share one shell; see shell.h.
  * Returns 0 on success, -1 on error. */
 int run_copilot_agent(const char* model, const char* system_prompt,
     const char* prompt, char** tool_patterns,
-    const char* tool_approval, const char** tool_allowlist,
-    int tool_output,
+    policy_t* policy, int shell_session, int tool_output,
     chunk_fn on_chunk, chunk_fn on_reasoning_chunk, void* on_chunk_data,
     turn_fn on_turn_start, turn_fn on_turn_end,
     copilot_result_t* out);
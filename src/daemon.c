@@ -0,0 +1,355 @@
+#include "daemon.h"
+#include "util.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Largest request body the daemon accepts */
+#define DAEMON_MAX_BODY (512UL * 1024 * 1024)
+
+char* daemon_socket_path(void)
+{
+    const char* env = getenv("ARTD_SOCKET");
+    if (env && env[0])
+    {
+        return strdup(env);
+    }
+    return home_path("/.artifice/artd.sock");
+}
+
+int daemon_connect(void)
+{
+    char* path = daemon_socket_path();
+    if (!path)
+    {
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        free(path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    free(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int daemon_available(void)
+{
+    int fd = daemon_connect();
+    if (fd < 0)
+    {
+        return 0;
+    }
+    close(fd);
+    return 1;
+}
+
+/* ---- I/O helpers ---- */
+
+/* sendmsg over iovs until everything is written; MSG_NOSIGNAL turns a
+ * vanished peer into EPIPE instead of SIGPIPE. */
+static int send_iov(int fd, struct iovec* iov, int count)
+{
+    while (count > 0)
+    {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)(count < IOV_MAX ? count : IOV_MAX);
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+/* Read exactly len bytes, polling so SIGINT can cancel the wait.
+ * Returns 0, -1 on error or EOF, -2 if interrupted. */
+static int recv_all(int fd, char* dst, size_t len)
+{
+    while (len > 0)
+    {
+        if (g_http_interrupted)
+        {
+            return -2;
+        }
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int r = poll(&pfd, 1, 100);
+        if (r < 0 && errno != EINTR)
+        {
+            return -1;
+        }
+        if (r <= 0)
+        {
+            continue;
+        }
+        ssize_t n = read(fd, dst, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        dst += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int daemon_write_frame(int fd, char type, const char* data, size_t len)
+{
+    unsigned char hdr[5];
+    hdr[0] = (unsigned char)type;
+    hdr[1] = (unsigned char)(len >> 24);
+    hdr[2] = (unsigned char)(len >> 16);
+    hdr[3] = (unsigned char)(len >> 8);
+    hdr[4] = (unsigned char)len;
+    struct iovec iov[2] = {
+        { .iov_base = hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = (void*)data, .iov_len = len },
+    };
+    return send_iov(fd, iov, len ? 2 : 1);
+}
+
+/* ---- Client ---- */
+
+int daemon_post_stream(const char* base_url, const char* api_key, const rope_t* body, http_data_fn on_data,
+    void* userdata, long* http_code, char* errbuf, size_t errlen)
+{
+    *http_code = 0;
+    int fd = daemon_connect();
+    if (fd < 0)
+    {
+        return -2;
+    }
+
+    buf_t head = { 0 };
+    buf_printf(&head, "POST %s\n", base_url);
+    if (api_key && api_key[0])
+    {
+        buf_printf(&head, "Authorization %s\n", api_key);
+    }
+    buf_printf(&head, "Content-Length %zu\n\n", body->len);
+
+    /* Header and body segments go out in one gathered write, uncopied */
+    struct iovec* iov = malloc((size_t)(body->count + 1) * sizeof(struct iovec));
+    if (!iov)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    iov[0].iov_base = head.data;
+    iov[0].iov_len = head.len;
+    memcpy(iov + 1, body->iov, (size_t)body->count * sizeof(struct iovec));
+    int sent = send_iov(fd, iov, body->count + 1);
+    free(iov);
+    buf_free(&head);
+    if (sent < 0)
+    {
+        close(fd);
+        return -2;
+    }
+
+    int ret = -1;
+    int received = 0;
+    buf_t payload = { 0 };
+    for (;;)
+    {
+        unsigned char hdr[5];
+        int r = recv_all(fd, (char*)hdr, sizeof(hdr));
+        if (r == -2)
+        {
+            errbuf[0] = '\0'; /* interrupted, like an aborted transfer */
+            break;
+        }
+        if (r < 0)
+        {
+            if (!received)
+            {
+                ret = -2;
+            }
+            else
+            {
+                snprintf(errbuf, errlen, "artd connection lost");
+            }
+            break;
+        }
+        received = 1;
+        size_t len = (size_t)hdr[1] << 24 | (size_t)hdr[2] << 16 | (size_t)hdr[3] << 8 | hdr[4];
+        buf_clear(&payload);
+        buf_reserve(&payload, len);
+        r = recv_all(fd, payload.data, len);
+        if (r < 0)
+        {
+            if (r == -2)
+            {
+                errbuf[0] = '\0';
+            }
+            else
+            {
+                snprintf(errbuf, errlen, "artd connection lost");
+            }
+            break;
+        }
+        payload.len = len;
+        payload.data[len] = '\0';
+
+        if (hdr[0] == DAEMON_FRAME_DATA)
+        {
+            on_data(payload.data, len, userdata);
+        }
+        else if (hdr[0] == DAEMON_FRAME_END)
+        {
+            /* "<ret> <http_code> <error>" */
+            char* p = payload.data;
+            ret = (int)strtol(p, &p, 10);
+            *http_code = strtol(p, &p, 10);
+            if (*p == ' ')
+            {
+                p++;
+            }
+            snprintf(errbuf, errlen, "%s", p);
+            break;
+        }
+    }
+    buf_free(&payload);
+    close(fd);
+    return ret;
+}
+
+/* ---- Daemon side ---- */
+
+int daemon_read_request(int fd, daemon_request_t* req)
+{
+    memset(req, 0, sizeof(*req));
+
+    /* Read until the blank line; any excess is the start of the body */
+    buf_t in = { 0 };
+    char* end = NULL;
+    while (!end)
+    {
+        buf_reserve(&in, 4096);
+        ssize_t n = read(fd, in.data + in.len, in.cap - in.len - 1);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0 || in.len > 64 * 1024)
+        {
+            buf_free(&in);
+            return -1;
+        }
+        in.len += (size_t)n;
+        in.data[in.len] = '\0';
+        end = strstr(in.data, "\n\n");
+    }
+
+    size_t length = 0;
+    int have_length = 0;
+    *end = '\0';
+    char* save = NULL;
+    for (char* line = strtok_r(in.data, "\n", &save); line; line = strtok_r(NULL, "\n", &save))
+    {
+        if (strncmp(line, "POST ", 5) == 0)
+        {
+            free(req->base_url);
+            req->base_url = strdup(line + 5);
+        }
+        else if (strncmp(line, "Authorization ", 14) == 0)
+        {
+            free(req->api_key);
+            req->api_key = strdup(line + 14);
+        }
+        else if (strncmp(line, "Content-Length ", 15) == 0)
+        {
+            length = (size_t)strtoull(line + 15, NULL, 10);
+            have_length = 1;
+        }
+    }
+    if (!req->base_url || !have_length || length > DAEMON_MAX_BODY)
+    {
+        buf_free(&in);
+        daemon_request_free(req);
+        return -1;
+    }
+
+    char* start = end + 2;
+    size_t have = in.len - (size_t)(start - in.data);
+    if (have > length)
+    {
+        have = length;
+    }
+    buf_reserve(&req->body, length);
+    buf_append(&req->body, start, have);
+    buf_free(&in);
+
+    while (req->body.len < length)
+    {
+        ssize_t n = read(fd, req->body.data + req->body.len, length - req->body.len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            daemon_request_free(req);
+            return -1;
+        }
+        req->body.len += (size_t)n;
+    }
+    if (req->body.data)
+    {
+        req->body.data[req->body.len] = '\0';
+    }
+    return 0;
+}
+
+void daemon_request_free(daemon_request_t* req)
+{
+    free(req->base_url);
+    free(req->api_key);
+    buf_free(&req->body);
+    memset(req, 0, sizeof(*req));
+}
@@ -0,0 +1,56 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "buf.h"
+#include "http.h"
+#include "rope.h"
+
+#include <stddef.h>
+
+/* Wire protocol between art and artd over a Unix stream socket.
+ *
+ * Request (client to daemon), followed by exactly <n> body bytes:
+ *
+ *     POST <base_url>\n
+ *     Authorization <api_key>\n      (optional)
+ *     Content-Length <n>\n
+ *     \n
+ *
+ * Response: a sequence of frames, each a type byte, a 4-byte big-endian
+ * payload length and the payload. 'D' carries raw response body bytes as
+ * they arrive; the final 'E' frame carries "<ret> <http_code> <error>". */
+
+#define DAEMON_FRAME_DATA 'D'
+#define DAEMON_FRAME_END 'E'
+
+typedef struct
+{
+    char* base_url;
+    char* api_key;
+    buf_t body;
+} daemon_request_t;
+
+/* Socket path: $ARTD_SOCKET, else ~/.artifice/artd.sock. Caller frees. */
+char* daemon_socket_path(void);
+
+/* Connect to the daemon. Returns a socket fd, or -1 if none is listening. */
+int daemon_connect(void);
+
+/* Non-zero if a daemon is accepting connections. */
+int daemon_available(void);
+
+/* Forward a chat completions POST through the daemon and pass the response
+ * body to on_data. Same contract as http_post_stream(), except that -2
+ * means the daemon could not be reached before anything was received and
+ * the caller should perform the request itself. */
+int daemon_post_stream(const char* base_url, const char* api_key, const rope_t* body, http_data_fn on_data,
+    void* userdata, long* http_code, char* errbuf, size_t errlen);
+
+/* Daemon side: read one request from fd. Returns 0 or -1. */
+int daemon_read_request(int fd, daemon_request_t* req);
+void daemon_request_free(daemon_request_t* req);
+
+/* Daemon side: send one frame. Returns 0 or -1 if the client is gone. */
+int daemon_write_frame(int fd, char type, const char* data, size_t len);
+
+#endif
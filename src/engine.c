@@ -0,0 +1,309 @@
+#include "engine.h"
+#include "http.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct http_request
+{
+    CURL* curl;
+    http_xfer_t xfer;
+    sse_parser_t parser;
+    http_done_fn on_done;
+    void* done_data;
+    int cancelled;
+    struct http_request* next;
+};
+
+/* Unlink r from the list at *head. Returns 1 if it was there. */
+static int list_remove(http_request_t** head, http_request_t* r)
+{
+    for (http_request_t** link = head; *link; link = &(*link)->next)
+    {
+        if (*link == r)
+        {
+            *link = r->next;
+            r->next = NULL;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Report the outcome and release everything the request owns. Runs on the
+ * engine thread with r already off both lists and out of the multi. */
+static void request_finish(http_request_t* r, int aborted, CURLcode res)
+{
+    char errbuf[512];
+    errbuf[0] = '\0';
+    int ret = -1;
+    http_status_t status = { 0, 0 };
+    if (!aborted)
+    {
+        http_xfer_status(r->curl, &status);
+        ret = http_xfer_result(&r->xfer, res, errbuf, sizeof(errbuf));
+        if (ret == 0)
+        {
+            ret = http_finish_sse(&r->parser, status.code, errbuf, sizeof(errbuf));
+        }
+        if (ret < 0)
+        {
+            http_sse_retry(&r->parser, &status);
+        }
+    }
+
+    http_xfer_cleanup(&r->xfer, r->curl);
+    curl_easy_cleanup(r->curl);
+    sse_free(&r->parser);
+    if (r->on_done)
+    {
+        r->on_done(ret, &status, errbuf, r->done_data);
+    }
+    free(r);
+}
+
+static void* engine_loop(void* arg)
+{
+    http_engine_t* e = arg;
+    for (;;)
+    {
+        /* Admit new requests and pull out the ones being aborted */
+        http_request_t* aborted = NULL;
+        pthread_mutex_lock(&e->lock);
+        while (e->queue)
+        {
+            http_request_t* r = e->queue;
+            e->queue = r->next;
+            curl_easy_setopt(r->curl, CURLOPT_SHARE, e->share);
+            curl_multi_add_handle(e->multi, r->curl);
+            r->next = e->active;
+            e->active = r;
+        }
+        int stop = e->stop;
+        int abort_all = stop || g_http_interrupted;
+        http_request_t** link = &e->active;
+        while (*link)
+        {
+            http_request_t* r = *link;
+            if (abort_all || r->cancelled)
+            {
+                *link = r->next;
+                curl_multi_remove_handle(e->multi, r->curl);
+                r->next = aborted;
+                aborted = r;
+            }
+            else
+            {
+                link = &r->next;
+            }
+        }
+        pthread_mutex_unlock(&e->lock);
+
+        while (aborted)
+        {
+            http_request_t* r = aborted;
+            aborted = r->next;
+            request_finish(r, 1, CURLE_ABORTED_BY_CALLBACK);
+        }
+        if (stop)
+        {
+            break;
+        }
+
+        int running = 0;
+        curl_multi_perform(e->multi, &running);
+
+        CURLMsg* msg;
+        int left;
+        while ((msg = curl_multi_info_read(e->multi, &left)))
+        {
+            if (msg->msg != CURLMSG_DONE)
+            {
+                continue;
+            }
+            CURL* curl = msg->easy_handle;
+            CURLcode res = msg->data.result;
+            http_request_t* r = NULL;
+            curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**)&r);
+
+            pthread_mutex_lock(&e->lock);
+            list_remove(&e->active, r);
+            pthread_mutex_unlock(&e->lock);
+            curl_multi_remove_handle(e->multi, curl);
+            request_finish(r, 0, res);
+        }
+
+        /* Wakes early on socket activity or curl_multi_wakeup(); the
+         * timeout bounds how long an interrupt goes unnoticed */
+        curl_multi_poll(e->multi, NULL, 0, 100, NULL);
+    }
+    return NULL;
+}
+
+int http_engine_init(http_engine_t* e)
+{
+    memset(e, 0, sizeof(*e));
+    e->multi = curl_multi_init();
+    e->share = curl_share_init();
+    if (!e->multi || !e->share)
+    {
+        curl_multi_cleanup(e->multi);
+        curl_share_cleanup(e->share);
+        return -1;
+    }
+    curl_multi_setopt(e->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_share_setopt(e->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(e->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    pthread_mutex_init(&e->lock, NULL);
+
+    if (pthread_create(&e->thread, NULL, engine_loop, e) != 0)
+    {
+        pthread_mutex_destroy(&e->lock);
+        curl_multi_cleanup(e->multi);
+        curl_share_cleanup(e->share);
+        return -1;
+    }
+    return 0;
+}
+
+void http_engine_free(http_engine_t* e)
+{
+    pthread_mutex_lock(&e->lock);
+    e->stop = 1;
+    pthread_mutex_unlock(&e->lock);
+    curl_multi_wakeup(e->multi);
+    pthread_join(e->thread, NULL);
+
+    pthread_mutex_destroy(&e->lock);
+    curl_multi_cleanup(e->multi);
+    curl_share_cleanup(e->share);
+    e->multi = NULL;
+    e->share = NULL;
+}
+
+http_request_t* http_engine_submit(http_engine_t* e, const char* base_url, const char* api_key, const rope_t* body,
+    int flags, sse_event_fn on_event, void* userdata, http_done_fn on_done, void* done_data)
+{
+    http_request_t* r = calloc(1, sizeof(*r));
+    if (!r)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    r->curl = curl_easy_init();
+    if (!r->curl)
+    {
+        free(r);
+        return NULL;
+    }
+    r->on_done = on_done;
+    r->done_data = done_data;
+    sse_init(&r->parser, on_event, userdata);
+
+    /* The handle is not in the multi yet, so it is still ours to set up */
+    http_handle_defaults(r->curl);
+    http_xfer_setup(&r->xfer, r->curl, base_url, api_key, body, flags, http_sse_data_cb, &r->parser);
+    r->xfer.stall_ms = e->stall_ms;
+    curl_easy_setopt(r->curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    /* Wait for an in-progress connection to the host so the stream can be
+     * multiplexed onto it instead of opening another */
+    curl_easy_setopt(r->curl, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(r->curl, CURLOPT_PRIVATE, (char*)r);
+
+    pthread_mutex_lock(&e->lock);
+    if (e->stop)
+    {
+        pthread_mutex_unlock(&e->lock);
+        http_xfer_cleanup(&r->xfer, r->curl);
+        curl_easy_cleanup(r->curl);
+        sse_free(&r->parser);
+        free(r);
+        return NULL;
+    }
+    r->next = e->queue;
+    e->queue = r;
+    pthread_mutex_unlock(&e->lock);
+    curl_multi_wakeup(e->multi);
+    return r;
+}
+
+void http_request_cancel(http_engine_t* e, http_request_t* r)
+{
+    pthread_mutex_lock(&e->lock);
+    int found = 0;
+    for (http_request_t* p = e->queue; p && !found; p = p->next)
+    {
+        found = p == r;
+    }
+    for (http_request_t* p = e->active; p && !found; p = p->next)
+    {
+        found = p == r;
+    }
+    if (found)
+    {
+        r->cancelled = 1;
+    }
+    pthread_mutex_unlock(&e->lock);
+    if (found)
+    {
+        curl_multi_wakeup(e->multi);
+    }
+}
+
+/* ---- Blocking wrapper ---- */
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;
+    int ret;
+    http_status_t status;
+    char* errbuf;
+    size_t errlen;
+} engine_waiter_t;
+
+static void waiter_done(int ret, const http_status_t* status, const char* err, void* userdata)
+{
+    engine_waiter_t* w = userdata;
+    pthread_mutex_lock(&w->lock);
+    w->ret = ret;
+    w->status = *status;
+    snprintf(w->errbuf, w->errlen, "%s", err);
+    w->done = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+int http_engine_stream_chat(http_engine_t* e, const char* base_url, const char* api_key, const rope_t* body,
+    int flags, sse_event_fn on_event, void* userdata, http_status_t* status, char* errbuf, size_t errlen)
+{
+    engine_waiter_t w;
+    memset(&w, 0, sizeof(w));
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.cond, NULL);
+    w.errbuf = errbuf;
+    w.errlen = errlen;
+
+    int ret = -1;
+    if (!http_engine_submit(e, base_url, api_key, body, flags, on_event, userdata, waiter_done, &w))
+    {
+        snprintf(errbuf, errlen, "HTTP engine unavailable");
+    }
+    else
+    {
+        pthread_mutex_lock(&w.lock);
+        while (!w.done)
+        {
+            pthread_cond_wait(&w.cond, &w.lock);
+        }
+        pthread_mutex_unlock(&w.lock);
+        ret = w.ret;
+    }
+    *status = w.status;
+
+    pthread_cond_destroy(&w.cond);
+    pthread_mutex_destroy(&w.lock);
+    return ret;
+}
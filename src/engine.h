@@ -0,0 +1,65 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "http.h"
+#include "rope.h"
+#include "sse.h"
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stddef.h>
+
+/* Asynchronous HTTP engine: any number of concurrent chat completions
+ * streams on one curl_multi handle, driven by a single event loop thread.
+ * Streams to the same host are multiplexed over a shared HTTP/2 connection
+ * where the server supports it, and share DNS and TLS session caches.
+ *
+ * All callbacks (on_event, on_done) run on the engine thread, one at a
+ * time; they must not block for long, since every other stream waits. */
+
+typedef struct http_request http_request_t;
+
+/* Called once per request when it has finished, failed or been cancelled.
+ * ret is 0 or -1; status says how the response ended, all zero if none
+ * arrived; err is empty when the request was cancelled or interrupted. The
+ * request is freed after this returns. */
+typedef void (*http_done_fn)(int ret, const http_status_t* status, const char* err, void* userdata);
+
+typedef struct http_engine
+{
+    CURLM* multi;
+    CURLSH* share; /* only touched by the engine thread */
+    pthread_t thread;
+    pthread_mutex_t lock; /* guards queue, active, cancelled flags and stop */
+    http_request_t* queue; /* submitted, not yet added to multi */
+    http_request_t* active; /* added to multi */
+    int stop;
+    long stall_ms; /* stall timeout of requests submitted from now on, 0 = none */
+} http_engine_t;
+
+/* Start the event loop thread. Returns 0 or -1. */
+int http_engine_init(http_engine_t* e);
+
+/* Cancel every pending request (their on_done still runs) and stop. */
+void http_engine_free(http_engine_t* e);
+
+/* Queue a streaming POST of body to base_url/chat/completions, with
+ * HTTP_* flags as for http_xfer_setup(). Each SSE
+ * event goes to on_event with userdata, then on_done with done_data.
+ * body must stay valid until on_done. Returns the request, or NULL if the
+ * engine is stopping or out of handles (no callbacks run then). */
+http_request_t* http_engine_submit(http_engine_t* e, const char* base_url, const char* api_key, const rope_t* body,
+    int flags, sse_event_fn on_event, void* userdata, http_done_fn on_done, void* done_data);
+
+/* Abort a request; its on_done runs with ret -1 and an empty err. A no-op
+ * if it has already finished. Safe from any thread, including from
+ * callbacks of other requests. */
+void http_request_cancel(http_engine_t* e, http_request_t* r);
+
+/* Blocking wrapper with the contract of http_stream_chat(): submit, wait
+ * for completion and return 0 or -1 with errbuf set. *status receives how
+ * the response ended. */
+int http_engine_stream_chat(http_engine_t* e, const char* base_url, const char* api_key, const rope_t* body,
+    int flags, sse_event_fn on_event, void* userdata, http_status_t* status, char* errbuf, size_t errlen);
+
+#endif
@@ -0,0 +1,42 @@
+#include "gzip.h"
+
+#include <zlib.h>
+
+int gzip_rope(const rope_t* body, buf_t* out)
+{
+    z_stream zs = { 0 };
+    /* 16 + MAX_WBITS selects the gzip wrapper */
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return -1;
+    }
+
+    /* The bound covers the whole output, so deflate never runs out of room */
+    size_t bound = deflateBound(&zs, (uLong)body->len);
+    buf_reserve(out, bound);
+    zs.next_out = (Bytef*)out->data + out->len;
+    zs.avail_out = (uInt)bound;
+
+    int ret = Z_OK;
+    for (int i = 0; i < body->count && ret == Z_OK; i++)
+    {
+        zs.next_in = (Bytef*)body->iov[i].iov_base;
+        zs.avail_in = (uInt)body->iov[i].iov_len;
+        while (zs.avail_in > 0 && ret == Z_OK)
+        {
+            ret = deflate(&zs, Z_NO_FLUSH);
+        }
+    }
+    if (ret == Z_OK)
+    {
+        ret = deflate(&zs, Z_FINISH);
+    }
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END)
+    {
+        return -1;
+    }
+    out->len += zs.total_out;
+    out->data[out->len] = '\0';
+    return 0;
+}
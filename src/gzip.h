@@ -0,0 +1,11 @@
+#ifndef GZIP_H
+#define GZIP_H
+
+#include "buf.h"
+#include "rope.h"
+
+/* Append body to out as one gzip member, for a Content-Encoding: gzip
+ * request. Returns 0, or -1 with out unchanged if zlib fails. */
+int gzip_rope(const rope_t* body, buf_t* out);
+
+#endif
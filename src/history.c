@@ -0,0 +1,89 @@
+#include "history.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Rough tokens-per-byte ratio for English text and code with BPE tokenizers */
+#define BYTES_PER_TOKEN 4
+
+static const char* role_names[] = {
+    [ROLE_SYSTEM] = "system",
+    [ROLE_USER] = "user",
+    [ROLE_ASSISTANT] = "assistant",
+    [ROLE_TOOL] = "tool",
+};
+
+void history_init(history_t* h)
+{
+    memset(h, 0, sizeof(*h));
+    buf_init(&h->wire);
+}
+
+void history_free(history_t* h)
+{
+    free(h->msgs);
+    buf_free(&h->wire);
+    memset(h, 0, sizeof(*h));
+}
+
+json_writer_t* history_begin(history_t* h, msg_role_t role)
+{
+    if (h->count >= h->cap)
+    {
+        h->cap = h->cap ? h->cap * 2 : 16;
+        message_t* tmp = realloc(h->msgs, (size_t)h->cap * sizeof(message_t));
+        if (!tmp)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        h->msgs = tmp;
+    }
+    message_t* m = &h->msgs[h->count];
+    m->role = role;
+    m->offset = h->wire.len;
+    m->bytes = 0;
+    m->tokens = 0;
+
+    jw_init(&h->w, &h->wire);
+    h->w.first = h->count == 0; /* comma-join with the previous message */
+    jw_object_begin(&h->w);
+    jw_key(&h->w, "role");
+    jw_string(&h->w, role_names[role]);
+    return &h->w;
+}
+
+void history_end(history_t* h, size_t content_len)
+{
+    jw_object_end(&h->w);
+    message_t* m = &h->msgs[h->count++];
+    m->bytes = h->wire.len - m->offset;
+    m->tokens = (int)((content_len + BYTES_PER_TOKEN - 1) / BYTES_PER_TOKEN);
+    h->tokens += m->tokens;
+}
+
+void history_add_text(history_t* h, msg_role_t role, const char* content)
+{
+    json_writer_t* w = history_begin(h, role);
+    jw_key(w, "content");
+    jw_string(w, content ? content : "");
+    history_end(h, content ? strlen(content) : 0);
+}
+
+int history_last_role(const history_t* h) { return h->count > 0 ? (int)h->msgs[h->count - 1].role : -1; }
+
+void history_pop(history_t* h)
+{
+    if (h->count == 0)
+    {
+        return;
+    }
+    message_t* m = &h->msgs[--h->count];
+    h->tokens -= m->tokens;
+    h->wire.len = m->offset;
+    if (h->wire.data)
+    {
+        h->wire.data[h->wire.len] = '\0';
+    }
+}
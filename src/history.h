@@ -0,0 +1,61 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "buf.h"
+#include "json.h"
+
+#include <stddef.h>
+
+typedef enum
+{
+    ROLE_SYSTEM,
+    ROLE_USER,
+    ROLE_ASSISTANT,
+    ROLE_TOOL,
+} msg_role_t;
+
+typedef struct
+{
+    msg_role_t role;
+    size_t offset; /* start of this message in history_t.wire (incl. comma) */
+    size_t bytes; /* serialized size */
+    int tokens; /* estimated tokens of its content */
+} message_t;
+
+/* Conversation history in wire format.
+ *
+ * Messages are serialized exactly once, when appended, into one contiguous
+ * buffer that doubles as the content arena; wire always holds the messages
+ * joined by commas, ready to splice into a request. message_t entries are a
+ * flat array, so append and pop are O(1). */
+typedef struct
+{
+    message_t* msgs;
+    int count;
+    int cap;
+    buf_t wire;
+    int tokens; /* sum of per-message estimates */
+    json_writer_t w; /* valid between history_begin() and history_end() */
+} history_t;
+
+void history_init(history_t* h);
+void history_free(history_t* h);
+
+/* Start a message: writes {"role":"..." and returns a writer positioned
+ * inside the object. Add the remaining keys, then call history_end(). */
+json_writer_t* history_begin(history_t* h, msg_role_t role);
+
+/* Close the message. content_len is the size of its text payload, used for
+ * the token estimate. */
+void history_end(history_t* h, size_t content_len);
+
+/* Append a {"role":...,"content":...} message. */
+void history_add_text(history_t* h, msg_role_t role, const char* content);
+
+/* Role of the last message, or -1 if empty. */
+int history_last_role(const history_t* h);
+
+/* Remove the last message. */
+void history_pop(history_t* h);
+
+#endif
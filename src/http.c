@@ -1,12 +1,20 @@
 #include "http.h"
+#include "balance.h"
 #include "buf.h"
+#include "daemon.h"
+#include "engine.h"
+#include "gzip.h"
+#include "limit.h"
 #include "sse.h"
 
+#include <arpa/inet.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 
 volatile sig_atomic_t g_http_interrupted = 0;
 
@@ -18,41 +26,228 @@ static const char* ca_paths[] = {
     NULL,
 };
 
-static const char* find_ca_bundle(void)
+static const char* ca_bundle;
+static pthread_once_t ca_once = PTHREAD_ONCE_INIT;
+
+static void find_ca_bundle(void)
 {
-    const char* env = getenv("CURL_CA_BUNDLE");
-    if (env)
-    {
-        return env;
-    }
+    ca_bundle = getenv("CURL_CA_BUNDLE");
     struct stat st;
-    for (const char** p = ca_paths; *p; p++)
+    for (const char** p = ca_paths; !ca_bundle && *p; p++)
     {
         if (stat(*p, &st) == 0)
         {
-            return *p;
+            ca_bundle = *p;
         }
     }
-    return NULL;
 }
 
-static size_t curl_sse_write_cb(char* ptr, size_t size, size_t nmemb, void* userdata)
+void http_handle_defaults(CURL* curl)
+{
+    /* Handles may run off the main thread; keep DNS timeouts signal-free */
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+}
+
+int http_is_local(const char* base_url)
+{
+    if (strncmp(base_url, "unix://", 7) == 0)
+    {
+        return 1;
+    }
+    if (strncmp(base_url, "http://", 7) != 0)
+    {
+        return 0;
+    }
+    const char* host = base_url + 7;
+    size_t len = host[0] == '[' ? strcspn(host, "]") + 1 : strcspn(host, ":/");
+    if ((len == 9 && strncmp(host, "localhost", 9) == 0) || (len == 5 && strncmp(host, "[::1]", 5) == 0))
+    {
+        return 1;
+    }
+
+    /* Only a numeric address in 127/8; a name like 127.example.com is remote */
+    char addr[INET_ADDRSTRLEN];
+    struct in_addr in;
+    if (len >= sizeof(addr))
+    {
+        return 0;
+    }
+    memcpy(addr, host, len);
+    addr[len] = '\0';
+    return inet_pton(AF_INET, addr, &in) == 1 && (ntohl(in.s_addr) >> 24) == 127;
+}
+
+/* Point curl at base_url followed by path, building the URL in url. A
+ * unix:///socket[:/base/path] base_url is reached through that socket;
+ * only https endpoints get the CA bundle, and local ones bypass proxies. */
+static void set_endpoint(CURL* curl, const char* base_url, const char* path, buf_t* url)
 {
-    return sse_feed((sse_parser_t*)userdata, ptr, size * nmemb);
+    if (strncmp(base_url, "unix://", 7) == 0)
+    {
+        const char* sock = base_url + 7;
+        const char* sep = strstr(sock, ":/");
+        char* sock_path = sep ? strndup(sock, (size_t)(sep - sock)) : strdup(sock);
+        if (!sock_path)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, sock_path);
+        free(sock_path);
+        buf_printf(url, "http://localhost%s%s", sep ? sep + 1 : "/v1", path);
+    }
+    else
+    {
+        curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, NULL);
+        buf_printf(url, "%s%s", base_url, path);
+    }
+    curl_easy_setopt(curl, CURLOPT_URL, url->data);
+
+    if (strncmp(base_url, "https://", 8) == 0)
+    {
+        pthread_once(&ca_once, find_ca_bundle);
+        if (ca_bundle)
+        {
+            curl_easy_setopt(curl, CURLOPT_CAINFO, ca_bundle);
+        }
+    }
+    curl_easy_setopt(curl, CURLOPT_NOPROXY, http_is_local(base_url) ? "*" : NULL);
+}
+
+static size_t curl_body_read_cb(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+    return rope_read((rope_reader_t*)userdata, ptr, size * nmemb);
+}
+
+static int curl_body_seek_cb(void* userdata, curl_off_t offset, int origin)
+{
+    /* curl only rewinds with SEEK_SET, e.g. to resend after a redirect */
+    if (origin != SEEK_SET || offset < 0)
+    {
+        return CURL_SEEKFUNC_CANTSEEK;
+    }
+    return rope_seek((rope_reader_t*)userdata, (size_t)offset) == 0 ? CURL_SEEKFUNC_OK : CURL_SEEKFUNC_FAIL;
+}
+
+static long since_ms(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
 }
 
 static int curl_xferinfo_cb(void* p, curl_off_t dt, curl_off_t dn, curl_off_t ut, curl_off_t un)
 {
-    (void)p;
+    http_xfer_t* x = p;
+    (void)dt;
+    (void)ut;
+    if (g_http_interrupted)
+    {
+        return 1;
+    }
+    if (x->stall_ms > 0)
+    {
+        /* Keep-alive comments count: they prove the server is still there */
+        if (dn + un != x->progress)
+        {
+            x->progress = dn + un;
+            clock_gettime(CLOCK_MONOTONIC, &x->progress_at);
+        }
+        else if (since_ms(&x->progress_at) >= x->stall_ms)
+        {
+            x->stalled = 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int curl_warm_xferinfo_cb(void* p, curl_off_t dt, curl_off_t dn, curl_off_t ut, curl_off_t un)
+{
+    http_client_t* c = p;
     (void)dt;
     (void)dn;
     (void)ut;
     (void)un;
-    return (int)g_http_interrupted;
+    return (int)(g_http_interrupted || atomic_load(&c->warm_cancel));
+}
+
+/* A HEAD request is the cheapest transfer that leaves an open, reusable
+ * connection in the handle's pool; CURLOPT_CONNECT_ONLY connections are
+ * never reused for regular transfers. The response itself is ignored. */
+static void* http_warm_thread(void* arg)
+{
+    http_client_t* c = arg;
+    buf_t url = { 0 };
+    set_endpoint(c->curl, c->base_url, "", &url);
+    curl_easy_setopt(c->curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(c->curl, CURLOPT_TIMEOUT, 15L);
+    curl_easy_setopt(c->curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(c->curl, CURLOPT_XFERINFOFUNCTION, curl_warm_xferinfo_cb);
+    curl_easy_setopt(c->curl, CURLOPT_XFERINFODATA, c);
+
+    CURLcode res = curl_easy_perform(c->curl);
+    if (res == CURLE_OK)
+    {
+        netcache_note_success(&c->net, c->curl);
+    }
+    else if (res == CURLE_COULDNT_CONNECT)
+    {
+        /* Stale cached address: let the real request resolve afresh */
+        netcache_unpin(&c->net, c->curl);
+    }
+
+    curl_easy_setopt(c->curl, CURLOPT_NOBODY, 0L);
+    curl_easy_setopt(c->curl, CURLOPT_TIMEOUT, 0L);
+    curl_easy_setopt(c->curl, CURLOPT_NOPROGRESS, 1L);
+    curl_easy_setopt(c->curl, CURLOPT_XFERINFOFUNCTION, NULL);
+    curl_easy_setopt(c->curl, CURLOPT_XFERINFODATA, NULL);
+    buf_free(&url);
+    return NULL;
+}
+
+void http_warm(http_client_t* c)
+{
+    /* A local connection costs less than the thread to open it early */
+    if (c->warming || http_is_local(c->base_url))
+    {
+        return;
+    }
+    atomic_store(&c->warm_cancel, 0);
+    if (pthread_create(&c->warm_thread, NULL, http_warm_thread, c) == 0)
+    {
+        c->warming = 1;
+    }
+}
+
+/* Wait for a pending warm-up so the handle can be used again. */
+static void http_warm_join(http_client_t* c, int cancel)
+{
+    if (!c->warming)
+    {
+        return;
+    }
+    if (cancel)
+    {
+        atomic_store(&c->warm_cancel, 1);
+    }
+    pthread_join(c->warm_thread, NULL);
+    c->warming = 0;
 }
 
 int http_init(http_client_t* c, const char* base_url, const char* api_key)
 {
+    c->warming = 0;
+    atomic_store(&c->warm_cancel, 0);
+    c->use_daemon = 0;
+    c->engine = NULL;
+    c->balance = NULL;
+    c->limit = NULL;
+    c->limit_key = -1;
+    c->stall_ms = 0;
+    c->retries = 0;
+    c->last_transient = 0;
+    c->last_retry_after_ms = 0;
     c->base_url = strdup(base_url ? base_url : "");
     c->api_key = strdup(api_key ? api_key : "");
     c->curl = curl_easy_init();
@@ -63,98 +258,499 @@ int http_init(http_client_t* c, const char* base_url, const char* api_key)
         return -1;
     }
 
-    const char* ca = find_ca_bundle();
-    if (ca)
-    {
-        curl_easy_setopt(c->curl, CURLOPT_CAINFO, ca);
-    }
+    http_handle_defaults(c->curl);
+
+    netcache_init(&c->net, c->base_url);
+    netcache_apply(&c->net, c->curl);
 
     return 0;
 }
 
+void http_init_engine(http_client_t* c, const char* base_url, const char* api_key, struct http_engine* e)
+{
+    memset(c, 0, sizeof(*c));
+    c->engine = e;
+    c->limit_key = -1;
+    c->base_url = strdup(base_url ? base_url : "");
+    c->api_key = strdup(api_key ? api_key : "");
+    if (!c->base_url || !c->api_key)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+}
+
 void http_free(http_client_t* c)
 {
+    http_warm_join(c, 1);
     if (c->curl)
     {
+        netcache_save(&c->net, c->curl);
         curl_easy_cleanup(c->curl);
     }
     c->curl = NULL;
+    netcache_free(&c->net);
     free(c->base_url);
     free(c->api_key);
     c->base_url = NULL;
     c->api_key = NULL;
 }
 
-int http_stream_chat(
-    http_client_t* c, const char* json_body, sse_event_fn on_event, void* userdata, char* errbuf, size_t errlen)
+static size_t curl_data_write_cb(char* ptr, size_t size, size_t nmemb, void* userdata)
 {
-    sse_parser_t parser;
-    sse_init(&parser, on_event, userdata);
-
-    buf_t url = { 0 };
-    buf_printf(&url, "%s/chat/completions", c->base_url);
+    http_xfer_t* x = userdata;
+    return x->on_data(ptr, size * nmemb, x->userdata);
+}
 
-    curl_easy_setopt(c->curl, CURLOPT_URL, url.data);
-    curl_easy_setopt(c->curl, CURLOPT_POSTFIELDS, json_body);
-    curl_easy_setopt(c->curl, CURLOPT_POST, 1L);
+void http_xfer_setup(http_xfer_t* x, CURL* curl, const char* base_url, const char* api_key, const rope_t* body,
+    int flags, http_data_fn on_data, void* userdata)
+{
+    memset(x, 0, sizeof(*x));
+    x->on_data = on_data;
+    x->userdata = userdata;
+    clock_gettime(CLOCK_MONOTONIC, &x->progress_at);
 
-    struct curl_slist* headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    headers = curl_slist_append(headers, "Accept: text/event-stream");
+    set_endpoint(curl, base_url, "/chat/completions", &x->url);
 
-    buf_t auth = { 0 };
-    if (c->api_key && c->api_key[0])
+    buf_init(&x->packed);
+    int packed = (flags & HTTP_GZIPPED_BODY) || ((flags & HTTP_GZIP_REQUEST) && gzip_rope(body, &x->packed) == 0);
+    if (packed && !(flags & HTTP_GZIPPED_BODY))
     {
-        buf_printf(&auth, "Authorization: Bearer %s", c->api_key);
-        headers = curl_slist_append(headers, auth.data);
+        rope_init_ref(&x->packed_rope, &x->packed_iov, x->packed.data, x->packed.len);
+        body = &x->packed_rope;
     }
 
-    curl_easy_setopt(c->curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(c->curl, CURLOPT_WRITEFUNCTION, curl_sse_write_cb);
-    curl_easy_setopt(c->curl, CURLOPT_WRITEDATA, &parser);
-    curl_easy_setopt(c->curl, CURLOPT_NOPROGRESS, 0L);
-    curl_easy_setopt(c->curl, CURLOPT_XFERINFOFUNCTION, curl_xferinfo_cb);
+    /* Stream the body segments straight from their owners, no flattening */
+    rope_reader_init(&x->reader, body);
 
-    CURLcode res = curl_easy_perform(c->curl);
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)body->len);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, curl_body_read_cb);
+    curl_easy_setopt(curl, CURLOPT_READDATA, &x->reader);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, curl_body_seek_cb);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, &x->reader);
 
-    long http_code = 0;
-    curl_easy_getinfo(c->curl, CURLINFO_RESPONSE_CODE, &http_code);
+    x->headers = curl_slist_append(x->headers, "Content-Type: application/json");
+    if (packed)
+    {
+        x->headers = curl_slist_append(x->headers, "Content-Encoding: gzip");
+    }
+    /* "" lets curl list, and transparently decode, every coding it was built with */
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, (flags & HTTP_ACCEPT_ENCODING) ? "" : NULL);
+    x->headers = curl_slist_append(x->headers, "Accept: text/event-stream");
+    /* Large bodies would otherwise wait for a 100-continue round trip */
+    x->headers = curl_slist_append(x->headers, "Expect:");
+    if (api_key && api_key[0])
+    {
+        buf_printf(&x->auth, "Authorization: Bearer %s", api_key);
+        x->headers = curl_slist_append(x->headers, x->auth.data);
+    }
 
-    curl_slist_free_all(headers);
-    buf_free(&url);
-    buf_free(&auth);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, x->headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_data_write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, x);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curl_xferinfo_cb);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, x);
+}
 
+void http_xfer_cleanup(http_xfer_t* x, CURL* curl)
+{
     /* Reset for reuse */
-    curl_easy_setopt(c->curl, CURLOPT_HTTPHEADER, NULL);
-    curl_easy_setopt(c->curl, CURLOPT_POSTFIELDS, NULL);
-    curl_easy_setopt(c->curl, CURLOPT_NOPROGRESS, 1L);
-    curl_easy_setopt(c->curl, CURLOPT_XFERINFOFUNCTION, NULL);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)-1);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, NULL);
+    curl_easy_setopt(curl, CURLOPT_READDATA, NULL);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, NULL);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, NULL);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, NULL);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, NULL);
 
-    int ret = 0;
+    curl_slist_free_all(x->headers);
+    buf_free(&x->url);
+    buf_free(&x->auth);
+    buf_free(&x->packed);
+    x->headers = NULL;
+}
+
+int http_xfer_result(const http_xfer_t* x, CURLcode res, char* errbuf, size_t errlen)
+{
+    if (res == CURLE_ABORTED_BY_CALLBACK && x->stalled)
+    {
+        snprintf(errbuf, errlen, "stream stalled: nothing received for %lds", x->stall_ms / 1000);
+        return -1;
+    }
     if (res == CURLE_ABORTED_BY_CALLBACK)
     {
         errbuf[0] = '\0';
-        ret = -1;
+        return -1;
     }
-    else if (res != CURLE_OK)
+    if (res != CURLE_OK)
     {
         snprintf(errbuf, errlen, "curl error: %s", curl_easy_strerror(res));
-        ret = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void http_xfer_status(CURL* curl, http_status_t* status)
+{
+    status->code = 0;
+    status->retry_after_ms = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status->code);
+#if LIBCURL_VERSION_NUM >= 0x074200
+    /* Parses both delta-seconds and HTTP-date forms */
+    curl_off_t seconds = 0;
+    if (curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &seconds) == CURLE_OK && seconds > 0)
+    {
+        status->retry_after_ms = (long)seconds * 1000;
+    }
+#endif
+}
+
+/* POST to base_url, which is c->base_url or one of its balanced replicas.
+ * Only c->base_url's address is pinned and cached. */
+static int post_stream_to(http_client_t* c, const char* base_url, const char* api_key, const rope_t* body, int flags,
+    http_data_fn on_data, void* userdata, http_status_t* status, char* errbuf, size_t errlen)
+{
+    http_warm_join(c, 0);
+    int primary = strcmp(base_url, c->base_url) == 0;
+
+    http_xfer_t x;
+    http_xfer_setup(&x, c->curl, base_url, api_key, body, flags, on_data, userdata);
+    x.stall_ms = c->stall_ms;
+
+    CURLcode res = curl_easy_perform(c->curl);
+    if (res == CURLE_COULDNT_CONNECT && primary && c->net.pinned)
+    {
+        /* The cached address went stale; nothing was sent, so resolve
+         * normally and try once more */
+        netcache_unpin(&c->net, c->curl);
+        rope_seek(&x.reader, 0);
+        res = curl_easy_perform(c->curl);
+    }
+    if (res == CURLE_OK && primary)
+    {
+        netcache_note_success(&c->net, c->curl);
+    }
+
+    http_xfer_status(c->curl, status);
+    int ret = http_xfer_result(&x, res, errbuf, errlen);
+    http_xfer_cleanup(&x, c->curl);
+    return ret;
+}
+
+int http_post_stream(http_client_t* c, const rope_t* body, http_data_fn on_data, void* userdata, long* http_code,
+    char* errbuf, size_t errlen)
+{
+    http_status_t status;
+    int ret = post_stream_to(c, c->base_url, c->api_key, body, c->flags, on_data, userdata, &status, errbuf, errlen);
+    *http_code = status.code;
+    return ret;
+}
+
+size_t http_sse_data_cb(const char* data, size_t len, void* userdata)
+{
+    return sse_feed((sse_parser_t*)userdata, data, len);
+}
+
+void http_sse_retry(const sse_parser_t* parser, http_status_t* status)
+{
+    if (!status->retry_after_ms && parser->retry_ms > 0)
+    {
+        status->retry_after_ms = parser->retry_ms;
     }
-    else if (http_code >= 400)
+}
+
+int http_finish_sse(sse_parser_t* parser, long http_code, char* errbuf, size_t errlen)
+{
+    if (http_code < 400)
     {
-        /* Include any response body the SSE parser accumulated */
-        if (parser.line_buf.data && parser.line_buf.len > 0)
+        sse_finish(parser);
+        return 0;
+    }
+    /* Include any response body the SSE parser accumulated */
+    if (parser->line_buf.data && parser->line_buf.len > 0)
+    {
+        snprintf(errbuf, errlen, "HTTP %ld: %s", http_code, parser->line_buf.data);
+    }
+    else
+    {
+        snprintf(errbuf, errlen, "HTTP %ld", http_code);
+    }
+    return -1;
+}
+
+/* One attempt against base_url over whichever transport applies. */
+static int stream_to(http_client_t* c, const char* base_url, const char* api_key, const rope_t* body, int flags,
+    sse_event_fn on_event, void* userdata, http_status_t* status, char* errbuf, size_t errlen)
+{
+    status->code = 0;
+    status->retry_after_ms = 0;
+    if (c->engine)
+    {
+        return http_engine_stream_chat(
+            c->engine, base_url, api_key, body, flags, on_event, userdata, status, errbuf, errlen);
+    }
+
+    sse_parser_t parser;
+    sse_init(&parser, on_event, userdata);
+
+    int ret = -2;
+    if (c->use_daemon)
+    {
+        ret = daemon_post_stream(
+            base_url, api_key, body, http_sse_data_cb, &parser, &status->code, errbuf, errlen);
+    }
+    if (ret == -2)
+    {
+        ret = post_stream_to(c, base_url, api_key, body, flags, http_sse_data_cb, &parser, status, errbuf, errlen);
+    }
+
+    if (ret == 0)
+    {
+        ret = http_finish_sse(&parser, status->code, errbuf, errlen);
+    }
+    if (ret < 0)
+    {
+        http_sse_retry(&parser, status);
+    }
+
+    sse_free(&parser);
+    return ret;
+}
+
+/* Passes events through, noting when the first one arrived */
+typedef struct
+{
+    sse_event_fn on_event;
+    void* userdata;
+    struct timespec start;
+    long first_ms; /* -1 until the first event */
+} first_event_t;
+
+static void first_event_cb(const sse_event_t* ev, void* userdata)
+{
+    first_event_t* f = userdata;
+    if (f->first_ms < 0)
+    {
+        f->first_ms = since_ms(&f->start);
+    }
+    f->on_event(ev, f->userdata);
+}
+
+/* Whether a failure might not recur: transport errors, stalls, 408, 429
+ * and 5xx. Other 4xx are the request's fault; an empty err is an interrupt. */
+static int is_transient(int ret, long http_code, const char* err)
+{
+    if (ret == 0 || !err[0] || g_http_interrupted)
+    {
+        return 0;
+    }
+    return !(http_code >= 400 && http_code < 500 && http_code != 408 && http_code != 429);
+}
+
+/* One request with api_key, spread over the balancer's replicas if there
+ * is one. *status is that of the last attempt. */
+static int stream_balanced(http_client_t* c, const char* api_key, const rope_t* body, int flags,
+    sse_event_fn on_event, void* userdata, http_status_t* status, char* errbuf, size_t errlen)
+{
+    balancer_t* b = c->balance;
+    if (!b || b->count < 2)
+    {
+        return stream_to(c, c->base_url, api_key, body, flags, on_event, userdata, status, errbuf, errlen);
+    }
+
+    char* tried = calloc((size_t)b->count, 1);
+    if (!tried)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    int ret = -1;
+    int i;
+    while ((i = balance_acquire(b, tried)) >= 0)
+    {
+        tried[i] = 1;
+        first_event_t f = { on_event, userdata, { 0, 0 }, -1 };
+        clock_gettime(CLOCK_MONOTONIC, &f.start);
+        errbuf[0] = '\0';
+        ret = stream_to(c, b->urls[i], api_key, body, flags, first_event_cb, &f, status, errbuf, errlen);
+
+        balance_outcome_t outcome = BALANCE_OK;
+        if (ret < 0)
+        {
+            outcome = is_transient(ret, status->code, errbuf) ? BALANCE_FAILED : BALANCE_NONE;
+        }
+        /* With a limiter a 429 is the key's quota, not the endpoint's
+         * health, and stream_limited() moves to another key */
+        if (c->limit && status->code == 429)
         {
-            snprintf(errbuf, errlen, "HTTP %ld: %s", http_code, parser.line_buf.data);
+            outcome = BALANCE_NONE;
         }
-        else
+        balance_release(b, i, outcome, f.first_ms >= 0 ? f.first_ms : since_ms(&f.start));
+        /* Fail over only while nothing has reached the caller */
+        if (outcome != BALANCE_FAILED || f.first_ms >= 0)
         {
-            snprintf(errbuf, errlen, "HTTP %ld", http_code);
+            break;
         }
-        ret = -1;
     }
+    free(tried);
+    return ret;
+}
 
-    sse_free(&parser);
+/* Wait until some key has budget for tokens. Returns its index, or -1 if
+ * interrupted. */
+static int limit_wait(limiter_t* l, long tokens)
+{
+    long wait_ms;
+    int key;
+    while ((key = limit_try(l, tokens, &wait_ms)) < 0)
+    {
+        if (http_sleep(wait_ms) < 0)
+        {
+            return -1;
+        }
+    }
+    return key;
+}
+
+/* With a limiter: wait for budget of estimate tokens, and move to another
+ * key on a 429. */
+static int stream_limited(http_client_t* c, const rope_t* body, int flags, long estimate, sse_event_fn on_event,
+    void* userdata, http_status_t* status, char* errbuf, size_t errlen)
+{
+    limiter_t* l = c->limit;
+    for (int attempt = 0;; attempt++)
+    {
+        int key = limit_wait(l, estimate);
+        if (key < 0)
+        {
+            errbuf[0] = '\0';
+            return -1;
+        }
+        /* Only whether an event arrived matters here, not when */
+        first_event_t f = { on_event, userdata, { 0, 0 }, -1 };
+        int ret = stream_balanced(c, l->keys[key], body, flags, first_event_cb, &f, status, errbuf, errlen);
+        if (ret < 0 && f.first_ms < 0)
+        {
+            /* Failed before any response: nothing was billed, so give the
+             * tokens back rather than charge each retry again */
+            limit_settle(l, key, estimate, 0);
+            if (status->code == 429 && attempt < LIMIT_RETRIES)
+            {
+                limit_pause(l, key, status->retry_after_ms);
+                continue;
+            }
+        }
+        if (ret == 0)
+        {
+            c->limit_key = key;
+            c->limit_charged = estimate;
+        }
+        return ret;
+    }
+}
+
+int http_stream_chat(
+    http_client_t* c, const rope_t* body, sse_event_fn on_event, void* userdata, char* errbuf, size_t errlen)
+{
+    http_status_t status = { 0, 0 };
+    int ret;
+    c->limit_key = -1;
+    /* About 4 bytes of JSON per prompt token; http_settle_usage() fixes it */
+    long estimate = (long)(body->len / 4);
+
+    /* Deflate once here, not again for every retry, replica and key */
+    int flags = c->flags;
+    buf_t packed;
+    rope_t packed_rope;
+    struct iovec packed_iov;
+    buf_init(&packed);
+    if ((flags & HTTP_GZIP_REQUEST) && gzip_rope(body, &packed) == 0)
+    {
+        rope_init_ref(&packed_rope, &packed_iov, packed.data, packed.len);
+        body = &packed_rope;
+        flags = (flags & ~HTTP_GZIP_REQUEST) | HTTP_GZIPPED_BODY;
+    }
+    else
+    {
+        flags &= ~HTTP_GZIP_REQUEST;
+    }
+
+    if (c->limit)
+    {
+        ret = stream_limited(c, body, flags, estimate, on_event, userdata, &status, errbuf, errlen);
+    }
+    else
+    {
+        ret = stream_balanced(c, c->api_key, body, flags, on_event, userdata, &status, errbuf, errlen);
+    }
+    buf_free(&packed);
+    /* A 429 left after the limiter has tried other keys is not retried
+     * again on top of that */
+    c->last_transient = is_transient(ret, status.code, errbuf) && !(c->limit && status.code == 429);
+    c->last_retry_after_ms = status.retry_after_ms;
     return ret;
 }
+
+void http_settle_usage(http_client_t* c, long tokens)
+{
+    if (c->limit && c->limit_key >= 0 && tokens > 0)
+    {
+        limit_settle(c->limit, c->limit_key, c->limit_charged, tokens);
+    }
+    c->limit_key = -1;
+}
+
+long http_retry_delay(const http_client_t* c, int attempt)
+{
+    if (!c->last_transient || attempt >= c->retries)
+    {
+        return -1;
+    }
+    if (c->last_retry_after_ms > 0)
+    {
+        return c->last_retry_after_ms <= HTTP_RETRY_AFTER_MAX_MS ? c->last_retry_after_ms : -1;
+    }
+    long delay = HTTP_RETRY_BASE_MS;
+    for (int i = 0; i < attempt && delay < HTTP_RETRY_MAX_MS; i++)
+    {
+        delay *= 2;
+    }
+    if (delay > HTTP_RETRY_MAX_MS)
+    {
+        delay = HTTP_RETRY_MAX_MS;
+    }
+    /* Jitter over the upper half so parallel clients spread out */
+    static _Thread_local unsigned seed;
+    if (!seed)
+    {
+        seed = (unsigned)time(NULL) ^ (unsigned)(uintptr_t)&seed;
+    }
+    return delay / 2 + (long)(rand_r(&seed) % (unsigned)(delay / 2 + 1));
+}
+
+int http_sleep(long ms)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;)
+    {
+        if (g_http_interrupted)
+        {
+            return -1;
+        }
+        long left = ms - since_ms(&start);
+        if (left <= 0)
+        {
+            return 0;
+        }
+        /* Sleep in slices so an interrupt is noticed promptly */
+        long slice = left < 100 ? left : 100;
+        struct timespec ts = { slice / 1000, (slice % 1000) * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+}
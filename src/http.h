@@ -1,27 +1,161 @@
 #ifndef HTTP_H
 #define HTTP_H
 
+#include "buf.h"
+#include "netcache.h"
+#include "rope.h"
 #include "sse.h"
 
 #include <curl/curl.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
 
 extern volatile sig_atomic_t g_http_interrupted;
 
+struct balancer;
+struct http_engine;
+struct limiter;
+
+/* Retries of a failed request that has produced no output yet */
+#define HTTP_RETRY_BASE_MS 500 /* first backoff, doubled per attempt */
+#define HTTP_RETRY_MAX_MS 30000
+#define HTTP_RETRY_AFTER_MAX_MS 60000 /* longer Retry-After waits are not retried */
+
+/* Content coding of a request, see http_client_t.flags */
+#define HTTP_GZIP_REQUEST 1 /* send the body gzip'd with Content-Encoding: gzip */
+#define HTTP_ACCEPT_ENCODING 2 /* offer every response coding curl can decode */
+#define HTTP_GZIPPED_BODY 4 /* the body is gzip'd already: send it as is with Content-Encoding: gzip */
+
+/* How a completed transfer ended, besides its body */
+typedef struct
+{
+    long code; /* HTTP status, 0 if none arrived */
+    long retry_after_ms; /* from a Retry-After header, 0 if none */
+} http_status_t;
+
 typedef struct
 {
     char* base_url;
     char* api_key;
     CURL* curl;
+    pthread_t warm_thread;
+    int warming; /* warm_thread is running and owns curl */
+    atomic_int warm_cancel; /* set by the caller, read by warm_thread */
+    netcache_t net; /* DNS and TLS state persisted across invocations */
+    int use_daemon; /* forward requests through artd when it is reachable */
+    struct http_engine* engine; /* if set, requests run on this shared engine */
+    struct balancer* balance; /* if set, requests go to its endpoints, not base_url */
+    struct limiter* limit; /* if set, requests wait for its budget and use its keys */
+    int limit_key; /* key of the last request, until its usage is settled */
+    long limit_charged; /* tokens charged for it up front */
+    long stall_ms; /* abort a transfer that receives nothing for this long, 0 = never */
+    int retries; /* attempts after the first, see http_retry_delay() */
+    int last_transient; /* the last request failed in a way worth retrying */
+    long last_retry_after_ms;
+    int flags; /* HTTP_GZIP_REQUEST, HTTP_ACCEPT_ENCODING */
 } http_client_t;
 
+/* Receives raw response body bytes. Returns len to continue; anything
+ * else aborts the transfer. */
+typedef size_t (*http_data_fn)(const char* data, size_t len, void* userdata);
+
+/* Per-transfer state of one chat completions POST, shared by the blocking
+ * client and the multi engine. */
+typedef struct
+{
+    buf_t url;
+    buf_t auth;
+    struct curl_slist* headers;
+    rope_reader_t reader;
+    buf_t packed; /* the compressed body, if HTTP_GZIP_REQUEST */
+    struct iovec packed_iov;
+    rope_t packed_rope;
+    http_data_fn on_data;
+    void* userdata;
+    long stall_ms; /* 0 = no stall detection */
+    curl_off_t progress; /* bytes moved, either way */
+    struct timespec progress_at;
+    int stalled;
+} http_xfer_t;
+
+/* Thread-safety options for a new easy handle. */
+void http_handle_defaults(CURL* curl);
+
+/* Whether base_url is on this host: unix:// or plain http to a loopback
+ * address. Such endpoints skip warm-up, artd, the connection cache and
+ * proxies. */
+int http_is_local(const char* base_url);
+
+/* Configure curl for a streaming POST of body with the given HTTP_* flags;
+ * x must stay put until http_xfer_cleanup(), which also resets the handle
+ * for reuse. A body that fails to compress is sent as is. */
+void http_xfer_setup(http_xfer_t* x, CURL* curl, const char* base_url, const char* api_key, const rope_t* body,
+    int flags, http_data_fn on_data, void* userdata);
+void http_xfer_cleanup(http_xfer_t* x, CURL* curl);
+
+/* Map a transfer's CURLcode to 0, or -1 with errbuf set (empty if it was
+ * interrupted). */
+int http_xfer_result(const http_xfer_t* x, CURLcode res, char* errbuf, size_t errlen);
+
+/* Read the status and Retry-After of the handle's last transfer. */
+void http_xfer_status(CURL* curl, http_status_t* status);
+
+/* http_data_fn feeding an sse_parser_t. */
+size_t http_sse_data_cb(const char* data, size_t len, void* userdata);
+
+/* Conclude an SSE stream whose transfer completed: dispatch the final event
+ * on success, or describe an HTTP error status. Returns 0 or -1. */
+int http_finish_sse(sse_parser_t* parser, long http_code, char* errbuf, size_t errlen);
+
+/* After a failed stream: the server's last "retry:" field is its advice on
+ * when to reconnect, and stands in for a Retry-After header it did not send. */
+void http_sse_retry(const sse_parser_t* parser, http_status_t* status);
+
 int http_init(http_client_t* c, const char* base_url, const char* api_key);
+
+/* Set up a client whose requests all run on engine e. It has no handle of
+ * its own, so warm-up, the connection cache and artd do not apply. */
+void http_init_engine(http_client_t* c, const char* base_url, const char* api_key, struct http_engine* e);
 void http_free(http_client_t* c);
 
-/* POST JSON body to base_url/chat/completions with SSE streaming.
- * Calls sse_event_fn for each SSE data line. Blocks until stream ends.
+/* Start DNS, TCP and TLS setup to base_url on a background thread, so it
+ * overlaps with whatever the caller does next. The next request waits for
+ * it and reuses the connection. Failures are ignored; the request then
+ * simply connects as usual. */
+void http_warm(http_client_t* c);
+
+/* POST the JSON body to base_url/chat/completions on this process's own
+ * connection and pass the raw response body to on_data. Returns 0 once the
+ * transfer completes, whatever the HTTP status (stored in *http_code), or
+ * -1 on a transport error (errbuf set) or interrupt (errbuf empty). */
+int http_post_stream(http_client_t* c, const rope_t* body, http_data_fn on_data, void* userdata, long* http_code,
+    char* errbuf, size_t errlen);
+
+/* POST the JSON body to base_url/chat/completions with SSE streaming:
+ * on the engine if one is attached, else through artd if use_daemon is set
+ * and it is up, else directly. With a balancer, base_url is the replica it
+ * picks, and a request that fails before streaming anything is retried on
+ * the next best one. With a limiter, the request first waits for budget on
+ * one of its keys, and a 429 is retried on the next key with budget.
+ * The body is streamed from its segments through a read callback.
+ * Calls sse_event_fn for each SSE event. Blocks until stream ends.
  * Returns 0 on success, -1 on error. errbuf receives error details. */
 int http_stream_chat(
-    http_client_t* c, const char* json_body, sse_event_fn on_event, void* userdata, char* errbuf, size_t errlen);
+    http_client_t* c, const rope_t* body, sse_event_fn on_event, void* userdata, char* errbuf, size_t errlen);
+
+/* Report the tokens the last successful http_stream_chat() actually used,
+ * so a rate limiter can correct its up-front estimate. */
+void http_settle_usage(http_client_t* c, long tokens);
+
+/* After the last http_stream_chat() failed, the wait before attempt number
+ * attempt (0-based) of a retry: the server's Retry-After, else jittered
+ * exponential backoff. Returns -1 if the failure is not transient (a 4xx
+ * other than 408 and 429, or an interrupt) or retries are used up. */
+long http_retry_delay(const http_client_t* c, int attempt);
+
+/* Sleep for ms, waking early on interrupt. Returns 0, or -1 if interrupted. */
+int http_sleep(long ms);
 
 #endif
@@ -0,0 +1,288 @@
+#include "json.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Length of the leading run of s that can be copied without escaping, i.e.
+ * contains no '"', '\\' or control character below 0x20. */
+static size_t clean_run(const char* s, size_t len)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i bslash = _mm256_set1_epi8('\\');
+    const __m256i ctl = _mm256_set1_epi8(0x1F);
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, bslash));
+        /* Unsigned v <= 0x1F  <=>  min(v, 0x1F) == v */
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask)
+        {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i quote16 = _mm_set1_epi8('"');
+    const __m128i bslash16 = _mm_set1_epi8('\\');
+    const __m128i ctl16 = _mm_set1_epi8(0x1F);
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote16), _mm_cmpeq_epi8(v, bslash16));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, ctl16), v));
+        unsigned mask = (unsigned)_mm_movemask_epi8(m);
+        if (mask)
+        {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < len; i++)
+    {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\' || c < 0x20)
+        {
+            break;
+        }
+    }
+    return i;
+}
+
+void json_escape(buf_t* b, const char* s, size_t len)
+{
+    /* Most strings need no escaping: reserve for the common case up front */
+    buf_reserve(b, len + 2);
+    buf_append(b, "\"", 1);
+    while (len > 0)
+    {
+        size_t n = clean_run(s, len);
+        buf_append(b, s, n);
+        s += n;
+        len -= n;
+        if (len == 0)
+        {
+            break;
+        }
+
+        unsigned char c = (unsigned char)*s++;
+        len--;
+        switch (c)
+        {
+        case '"':
+            buf_append(b, "\\\"", 2);
+            break;
+        case '\\':
+            buf_append(b, "\\\\", 2);
+            break;
+        case '\b':
+            buf_append(b, "\\b", 2);
+            break;
+        case '\f':
+            buf_append(b, "\\f", 2);
+            break;
+        case '\n':
+            buf_append(b, "\\n", 2);
+            break;
+        case '\r':
+            buf_append(b, "\\r", 2);
+            break;
+        case '\t':
+            buf_append(b, "\\t", 2);
+            break;
+        default:
+            buf_printf(b, "\\u%04x", c);
+            break;
+        }
+    }
+    buf_append(b, "\"", 1);
+}
+
+void jw_init(json_writer_t* w, buf_t* out)
+{
+    w->out = out;
+    w->first = 1;
+}
+
+/* Emit the separator for a new key or value at the current level. */
+static void jw_sep(json_writer_t* w)
+{
+    if (!w->first)
+    {
+        buf_append(w->out, ",", 1);
+    }
+    w->first = 0;
+}
+
+void jw_object_begin(json_writer_t* w)
+{
+    jw_sep(w);
+    buf_append(w->out, "{", 1);
+    w->first = 1;
+}
+
+void jw_object_end(json_writer_t* w)
+{
+    buf_append(w->out, "}", 1);
+    w->first = 0;
+}
+
+void jw_array_begin(json_writer_t* w)
+{
+    jw_sep(w);
+    buf_append(w->out, "[", 1);
+    w->first = 1;
+}
+
+void jw_array_end(json_writer_t* w)
+{
+    buf_append(w->out, "]", 1);
+    w->first = 0;
+}
+
+void jw_key(json_writer_t* w, const char* key)
+{
+    jw_sep(w);
+    json_escape(w->out, key, strlen(key));
+    buf_append(w->out, ":", 1);
+    w->first = 1; /* the value follows without a comma */
+}
+
+void jw_string(json_writer_t* w, const char* s)
+{
+    if (!s)
+    {
+        jw_null(w);
+        return;
+    }
+    jw_string_len(w, s, strlen(s));
+}
+
+void jw_string_len(json_writer_t* w, const char* s, size_t len)
+{
+    jw_sep(w);
+    json_escape(w->out, s, len);
+}
+
+void jw_int(json_writer_t* w, long long v)
+{
+    jw_sep(w);
+    buf_printf(w->out, "%lld", v);
+}
+
+void jw_bool(json_writer_t* w, int v)
+{
+    jw_sep(w);
+    if (v)
+    {
+        buf_append(w->out, "true", 4);
+    }
+    else
+    {
+        buf_append(w->out, "false", 5);
+    }
+}
+
+void jw_null(json_writer_t* w)
+{
+    jw_sep(w);
+    buf_append(w->out, "null", 4);
+}
+
+void jw_raw(json_writer_t* w, const char* json, size_t len)
+{
+    jw_sep(w);
+    buf_append(w->out, json, len);
+}
+
+static void jw_number(json_writer_t* w, const cJSON* item)
+{
+    double d = item->valuedouble;
+    jw_sep(w);
+    if (isnan(d) || isinf(d))
+    {
+        buf_append(w->out, "null", 4);
+    }
+    else if (d == (double)item->valueint)
+    {
+        buf_printf(w->out, "%d", item->valueint);
+    }
+    else
+    {
+        /* Shortest of 15 or 17 significant digits that round-trips */
+        char tmp[32];
+        snprintf(tmp, sizeof(tmp), "%1.15g", d);
+        if (strtod(tmp, NULL) != d)
+        {
+            snprintf(tmp, sizeof(tmp), "%1.17g", d);
+        }
+        buf_append_str(w->out, tmp);
+    }
+}
+
+void jw_cjson(json_writer_t* w, const cJSON* item)
+{
+    if (!item)
+    {
+        jw_null(w);
+        return;
+    }
+    switch (item->type & 0xFF)
+    {
+    case cJSON_False:
+        jw_bool(w, 0);
+        break;
+    case cJSON_True:
+        jw_bool(w, 1);
+        break;
+    case cJSON_NULL:
+        jw_null(w);
+        break;
+    case cJSON_Number:
+        jw_number(w, item);
+        break;
+    case cJSON_String:
+        jw_string(w, item->valuestring ? item->valuestring : "");
+        break;
+    case cJSON_Raw:
+        jw_raw(w, item->valuestring ? item->valuestring : "", item->valuestring ? strlen(item->valuestring) : 0);
+        break;
+    case cJSON_Array:
+    {
+        jw_array_begin(w);
+        const cJSON* child = NULL;
+        cJSON_ArrayForEach(child, item)
+        {
+            jw_cjson(w, child);
+        }
+        jw_array_end(w);
+        break;
+    }
+    case cJSON_Object:
+    {
+        jw_object_begin(w);
+        const cJSON* child = NULL;
+        cJSON_ArrayForEach(child, item)
+        {
+            jw_key(w, child->string ? child->string : "");
+            jw_cjson(w, child);
+        }
+        jw_object_end(w);
+        break;
+    }
+    default:
+        jw_null(w);
+        break;
+    }
+}
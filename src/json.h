@@ -0,0 +1,46 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include "buf.h"
+
+#include <cJSON.h>
+#include <stddef.h>
+
+/* Streaming JSON writer that appends compact JSON to a buf_t.
+ *
+ * Commas are inserted automatically: every key or value written after the
+ * first one at the current nesting level is preceded by ','. Strings are
+ * escaped with a vectorized scan that copies clean runs in bulk, so large
+ * tool outputs encode at close to memcpy speed. */
+typedef struct
+{
+    buf_t* out;
+    int first; /* nothing written yet at the current level */
+} json_writer_t;
+
+void jw_init(json_writer_t* w, buf_t* out);
+
+void jw_object_begin(json_writer_t* w);
+void jw_object_end(json_writer_t* w);
+void jw_array_begin(json_writer_t* w);
+void jw_array_end(json_writer_t* w);
+
+/* Write an object key; the next call must write its value. */
+void jw_key(json_writer_t* w, const char* key);
+
+void jw_string(json_writer_t* w, const char* s); /* NULL writes null */
+void jw_string_len(json_writer_t* w, const char* s, size_t len);
+void jw_int(json_writer_t* w, long long v);
+void jw_bool(json_writer_t* w, int v);
+void jw_null(json_writer_t* w);
+
+/* Write already-serialized JSON verbatim as one value. */
+void jw_raw(json_writer_t* w, const char* json, size_t len);
+
+/* Write a cJSON tree, formatted like cJSON_PrintUnformatted(). */
+void jw_cjson(json_writer_t* w, const cJSON* item);
+
+/* Append s as a quoted, escaped JSON string. */
+void json_escape(buf_t* b, const char* s, size_t len);
+
+#endif
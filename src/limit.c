@@ -0,0 +1,215 @@
+#include "limit.h"
+#include "util.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define LIMIT_MAGIC 0x6172746cu /* "artl" */
+#define LIMIT_VERSION 1
+#define LIMIT_SLOTS 256
+#define LIMIT_NAME_MAX 64
+
+/* One key's buckets; 128 bytes. Times are wall-clock milliseconds so every
+ * process agrees on them. */
+typedef struct
+{
+    char name[LIMIT_NAME_MAX]; /* "" = free slot */
+    double requests; /* available, refilled at rpm per minute */
+    double tokens; /* may go negative when usage beat the estimate */
+    int64_t refilled_ms;
+    int64_t paused_until_ms;
+    int64_t updated_ms;
+    int64_t reserved[3];
+} limit_slot_t;
+
+struct limit_table
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t reserved;
+    limit_slot_t slots[LIMIT_SLOTS];
+};
+
+/* Keys are identified by a hash, never stored */
+static void slot_name(const limiter_t* l, int index, char* out, size_t len)
+{
+    uint64_t h = 14695981039346656037u;
+    for (const char* p = l->keys[index]; *p; p++)
+    {
+        h = (h ^ (unsigned char)*p) * 1099511628211u;
+    }
+    snprintf(out, len, "%.46s/%016llx", l->agent, (unsigned long long)h);
+}
+
+/* Find key index's slot, claiming a free one (or the least recently used)
+ * with full buckets if it has none, and refill it. Called locked. */
+static limit_slot_t* slot_for(limiter_t* l, int index, int64_t now)
+{
+    char name[LIMIT_NAME_MAX];
+    slot_name(l, index, name, sizeof(name));
+    int found;
+    limit_slot_t* s = state_slot(l->table->slots, LIMIT_SLOTS, sizeof(limit_slot_t), LIMIT_NAME_MAX,
+        offsetof(limit_slot_t, updated_ms), name, &found);
+    if (!found)
+    {
+        memset(s, 0, sizeof(*s));
+        snprintf(s->name, sizeof(s->name), "%s", name);
+        s->requests = (double)l->rpm;
+        s->tokens = (double)l->tpm;
+        s->refilled_ms = now;
+    }
+
+    double minutes = (double)(now - s->refilled_ms) / 60000.0;
+    if (minutes > 0)
+    {
+        s->requests += minutes * (double)l->rpm;
+        s->tokens += minutes * (double)l->tpm;
+        s->refilled_ms = now;
+    }
+    if (s->requests > (double)l->rpm)
+    {
+        s->requests = (double)l->rpm;
+    }
+    if (s->tokens > (double)l->tpm)
+    {
+        s->tokens = (double)l->tpm;
+    }
+    s->updated_ms = now;
+    return s;
+}
+
+void limit_init(limiter_t* l, const char* agent, char** keys, char* key, long rpm, long tpm)
+{
+    memset(l, 0, sizeof(*l));
+    l->agent = agent ? agent : "";
+    l->single[0] = key ? key : "";
+    l->keys = keys && keys[0] ? keys : l->single;
+    while (l->keys[l->count])
+    {
+        l->count++;
+    }
+    l->rpm = rpm > 0 ? rpm : 0;
+    l->tpm = tpm > 0 ? tpm : 0;
+    l->table_len = sizeof(struct limit_table);
+    l->table = map_state_file("/.artifice/cache/limits", l->table_len, &l->fd);
+    pthread_mutex_init(&l->lock, NULL);
+
+    state_lock(&l->lock, l->fd);
+    if (l->table->magic != LIMIT_MAGIC || l->table->version != LIMIT_VERSION)
+    {
+        memset(l->table, 0, l->table_len);
+        l->table->magic = LIMIT_MAGIC;
+        l->table->version = LIMIT_VERSION;
+    }
+    state_unlock(&l->lock, l->fd);
+}
+
+void limit_free(limiter_t* l)
+{
+    if (l->table)
+    {
+        munmap(l->table, l->table_len);
+    }
+    if (l->fd >= 0)
+    {
+        close(l->fd);
+    }
+    pthread_mutex_destroy(&l->lock);
+    memset(l, 0, sizeof(*l));
+    l->fd = -1;
+}
+
+int limit_try(limiter_t* l, long tokens, long* wait_ms)
+{
+    /* A request larger than the whole budget waits for a full bucket */
+    double need = (double)(l->tpm && tokens > l->tpm ? l->tpm : tokens);
+    state_lock(&l->lock, l->fd);
+    int64_t now = state_now_ms();
+    int64_t soonest = -1;
+    int chosen = -1;
+    unsigned first = l->rotor++;
+    for (int n = 0; n < l->count && chosen < 0; n++)
+    {
+        int i = (int)((first + (unsigned)n) % (unsigned)l->count);
+        limit_slot_t* s = slot_for(l, i, now);
+        int64_t wait = s->paused_until_ms > now ? s->paused_until_ms - now : 0;
+        if (l->rpm && s->requests < 1)
+        {
+            int64_t w = (int64_t)((1 - s->requests) * 60000.0 / (double)l->rpm) + 1;
+            wait = w > wait ? w : wait;
+        }
+        if (l->tpm && s->tokens < need)
+        {
+            int64_t w = (int64_t)((need - s->tokens) * 60000.0 / (double)l->tpm) + 1;
+            wait = w > wait ? w : wait;
+        }
+        if (wait == 0)
+        {
+            chosen = i;
+            if (l->rpm)
+            {
+                s->requests -= 1;
+            }
+            if (l->tpm)
+            {
+                s->tokens -= (double)tokens;
+            }
+        }
+        else if (soonest < 0 || wait < soonest)
+        {
+            soonest = wait;
+        }
+    }
+    state_unlock(&l->lock, l->fd);
+    *wait_ms = chosen < 0 ? (long)soonest : 0;
+    return chosen;
+}
+
+void limit_settle(limiter_t* l, int index, long charged, long used)
+{
+    if (index < 0 || index >= l->count || !l->tpm || used == charged)
+    {
+        return;
+    }
+    state_lock(&l->lock, l->fd);
+    limit_slot_t* s = slot_for(l, index, state_now_ms());
+    s->tokens += (double)(charged - used);
+    if (s->tokens > (double)l->tpm)
+    {
+        s->tokens = (double)l->tpm;
+    }
+    state_unlock(&l->lock, l->fd);
+}
+
+void limit_pause(limiter_t* l, int index, long retry_after_ms)
+{
+    if (index < 0 || index >= l->count)
+    {
+        return;
+    }
+    if (retry_after_ms <= 0)
+    {
+        retry_after_ms = l->rpm ? 60000 / l->rpm : 0;
+    }
+    if (retry_after_ms < LIMIT_PAUSE_MS)
+    {
+        retry_after_ms = LIMIT_PAUSE_MS;
+    }
+    state_lock(&l->lock, l->fd);
+    int64_t now = state_now_ms();
+    limit_slot_t* s = slot_for(l, index, now);
+    if (s->paused_until_ms < now + retry_after_ms)
+    {
+        s->paused_until_ms = now + retry_after_ms;
+    }
+    if (s->requests > 0)
+    {
+        s->requests = 0;
+    }
+    state_unlock(&l->lock, l->fd);
+}
@@ -0,0 +1,53 @@
+#ifndef LIMIT_H
+#define LIMIT_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* Client-side rate limiting and API key rotation for one agent.
+ *
+ * Each of the agent's keys has two token buckets: requests per minute and
+ * tokens per minute. A request takes one request token and an estimate of
+ * its tokens up front; the estimate is corrected once the response reports
+ * its usage. Buckets live in ~/.artifice/cache/limits, mmap'd shared, so
+ * every art process on the host draws from the same budget. A key that
+ * gets a 429 is paused and its request bucket emptied. */
+
+#define LIMIT_PAUSE_MS 1000 /* minimum pause of a key after a 429 */
+#define LIMIT_RETRIES 4 /* 429s retried, on whichever key is free, per request */
+
+struct limit_table;
+
+typedef struct limiter
+{
+    const char* agent; /* bucket names are "<agent>/<key hash>" */
+    char** keys; /* NULL-terminated, borrowed; single when one key */
+    char* single[2];
+    int count;
+    long rpm; /* 0 = unlimited */
+    long tpm;
+    struct limit_table* table;
+    size_t table_len;
+    int fd; /* lock file descriptor, -1 if the table is private */
+    pthread_mutex_t lock; /* flock does not exclude threads sharing fd */
+    unsigned rotor; /* rotates through keys with budget left */
+} limiter_t;
+
+/* Set up limits for agent over keys (NULL-terminated, or NULL to use the
+ * single key). keys, key and agent must outlive l. */
+void limit_init(limiter_t* l, const char* agent, char** keys, char* key, long rpm, long tpm);
+void limit_free(limiter_t* l);
+
+/* Take one request and tokens from the next key with budget for both.
+ * Returns the key index, or -1 with *wait_ms set to how long until one
+ * will have it. */
+int limit_try(limiter_t* l, long tokens, long* wait_ms);
+
+/* Correct key index's token bucket once a request's real usage is known. */
+void limit_settle(limiter_t* l, int index, long charged, long used);
+
+/* A request on key index got a 429: pause the key for retry_after_ms, or
+ * for long enough to regain one request if that is 0. */
+void limit_pause(limiter_t* l, int index, long retry_after_ms);
+
+#endif
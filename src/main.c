@@ -1,12 +1,17 @@
 #include "agent.h"
+#include "balance.h"
+#include "batch.h"
 #include "buf.h"
 #include "config.h"
 #include "copilot_agent.h"
+#include "daemon.h"
+#include "engine.h"
 #include "http.h"
+#include "limit.h"
+#include "policy.h"
 #include "prompts.h"
 #include "runner.h"
 #include "session.h"
-#include "tools.h"
 #include "util.h"
 
 #include "spinner.h"
@@ -51,16 +56,36 @@ static void print_reasoning_chunk(const char* text, void* userdata)
     spinner_write_reasoning_chunk(text);
 }
 
+/* --stats: what the run cost, on stderr after the response */
+static void print_stats(const agent_t* agent, const loop_result_t* result)
+{
+    const arena_t* a = &agent->turn;
+    fprintf(stderr, "tokens: %d in, %d out\n", result->input_tokens, result->output_tokens);
+    fprintf(stderr, "turn arena: %lu allocations, %lu (%lu%%) without malloc\n", a->allocs, a->avoided,
+        a->allocs ? a->avoided * 100 / a->allocs : 0);
+}
+
+/* Append all of stdin to b, reading straight into its storage. */
+static void read_stdin_into(buf_t* b)
+{
+    for (;;)
+    {
+        buf_reserve(b, 64 * 1024);
+        size_t n = fread(b->data + b->len, 1, b->cap - b->len - 1, stdin);
+        if (n == 0)
+        {
+            break;
+        }
+        b->len += n;
+        b->data[b->len] = '\0';
+    }
+}
+
 /* Read all of stdin into a malloc'd string. */
 static char* read_stdin(void)
 {
     buf_t b = { 0 };
-    char tmp[4096];
-    size_t n;
-    while ((n = fread(tmp, 1, sizeof(tmp), stdin)) > 0)
-    {
-        buf_append(&b, tmp, n);
-    }
+    read_stdin_into(&b);
     return buf_detach(&b);
 }
 
@@ -101,33 +126,18 @@ static void resolve_at_files(
     }
 }
 
+/* Attachments and stdin are read directly into the message buffer, so the
+ * message is the only copy of their content. */
 static char* build_user_message(const char* prompt_arg, int is_tty, char** files, int file_count)
 {
     buf_t msg = { 0 };
 
     /* Read file attachments */
-    if (file_count > 0)
+    const char* failed = NULL;
+    if (append_attachments(&msg, files, file_count, &failed) < 0)
     {
-        for (int i = 0; i < file_count; i++)
-        {
-            char* content = read_file_contents(files[i], NULL);
-            if (!content)
-            {
-                fprintf(stderr, "Error reading %s\n", files[i]);
-                exit(1);
-            }
-
-            if (msg.len > 0)
-            {
-                buf_append_str(&msg, "\n\n");
-            }
-            buf_printf(&msg, "--- %s ---\n%s", files[i], content);
-            free(content);
-        }
-        if (msg.len > 0)
-        {
-            buf_append_str(&msg, "\n\n---\n\n");
-        }
+        fprintf(stderr, "Error reading %s\n", failed);
+        exit(1);
     }
 
     /* Prompt from argument */
@@ -139,16 +149,22 @@ static char* build_user_message(const char* prompt_arg, int is_tty, char** files
     /* Stdin content */
     if (!is_tty)
     {
-        char* stdin_content = read_stdin();
-        if (stdin_content && stdin_content[0])
+        size_t before = msg.len;
+        if (msg.len > 0)
         {
-            if (msg.len > 0)
+            buf_append_str(&msg, "\n\n");
+        }
+        size_t start = msg.len;
+        read_stdin_into(&msg);
+        if (msg.len == start || msg.data[start] == '\0')
+        {
+            /* Empty stdin: drop the separator */
+            msg.len = before;
+            if (msg.data)
             {
-                buf_append_str(&msg, "\n\n");
+                msg.data[msg.len] = '\0';
             }
-            buf_append_str(&msg, stdin_content);
         }
-        free(stdin_content);
     }
 
     return buf_detach(&msg);
@@ -213,6 +229,10 @@ enum
     OPT_GET_CURRENT_AGENT,
     OPT_SET_AGENT,
     OPT_NO_SPINNER,
+    OPT_BATCH,
+    OPT_CONCURRENCY,
+    OPT_BATCH_ORDER,
+    OPT_STATS,
 };
 
 static struct option long_options[] = {
@@ -231,6 +251,10 @@ static struct option long_options[] = {
     { "get-current-agent", no_argument, 0, OPT_GET_CURRENT_AGENT },
     { "set-agent", required_argument, 0, OPT_SET_AGENT },
     { "no-spinner", no_argument, 0, OPT_NO_SPINNER },
+    { "batch", required_argument, 0, OPT_BATCH },
+    { "concurrency", required_argument, 0, OPT_CONCURRENCY },
+    { "batch-order", required_argument, 0, OPT_BATCH_ORDER },
+    { "stats", no_argument, 0, OPT_STATS },
     { "help", no_argument, 0, 'h' },
     { 0, 0, 0, 0 },
 };
@@ -258,6 +282,10 @@ static void usage(void)
         "      --get-current-agent   Print current agent and exit\n"
         "      --set-agent NAME      Set default agent in config\n"
         "      --no-spinner          Disable the progress spinner\n"
+        "      --batch FILE          Run each JSONL record of FILE ('-' = stdin)\n"
+        "      --concurrency N       Batch records in flight at once (default 4)\n"
+        "      --batch-order ORDER   Write results in input or completion order\n"
+        "      --stats               Print token and allocation counts at exit\n"
         "  -h, --help                Show this help\n");
 }
 
@@ -302,6 +330,10 @@ int main(int argc, char** argv)
     int opt_get_current_agent = 0;
     char* opt_set_agent = NULL;
     int opt_no_spinner = 0;
+    char* opt_batch = NULL;
+    int opt_concurrency = 4;
+    int opt_completion_order = 0;
+    int opt_stats = 0;
 
     optind = 1;
     int c;
@@ -354,6 +386,33 @@ int main(int argc, char** argv)
         case OPT_NO_SPINNER:
             opt_no_spinner = 1;
             break;
+        case OPT_BATCH:
+            opt_batch = optarg;
+            break;
+        case OPT_CONCURRENCY:
+            opt_concurrency = atoi(optarg);
+            if (opt_concurrency < 1)
+            {
+                fprintf(stderr, "Error: --concurrency must be at least 1\n");
+                exit_code = 1;
+                goto cleanup_argv;
+            }
+            break;
+        case OPT_BATCH_ORDER:
+            if (strcmp(optarg, "input") == 0 || strcmp(optarg, "completion") == 0)
+            {
+                opt_completion_order = strcmp(optarg, "completion") == 0;
+            }
+            else
+            {
+                fprintf(stderr, "Error: --batch-order must be 'input' or 'completion'\n");
+                exit_code = 1;
+                goto cleanup_argv;
+            }
+            break;
+        case OPT_STATS:
+            opt_stats = 1;
+            break;
         case 'h':
             usage();
             goto cleanup_argv;
@@ -574,6 +633,48 @@ int main(int argc, char** argv)
         goto cleanup_cfg;
     }
 
+    /* Handle --batch */
+    if (opt_batch)
+    {
+        char* batch_prompt = NULL;
+        if (opt_prompt_name)
+        {
+            batch_prompt = load_prompt(opt_prompt_name);
+            if (!batch_prompt)
+            {
+                fprintf(stderr, "Error: Unknown prompt '%s'\n", opt_prompt_name);
+                exit_code = 1;
+                goto cleanup_cfg;
+            }
+        }
+        char** batch_tools = parse_tool_patterns(opt_tools);
+
+        batch_opts_t bo;
+        memset(&bo, 0, sizeof(bo));
+        bo.path = opt_batch;
+        bo.concurrency = opt_concurrency;
+        bo.completion_order = opt_completion_order;
+        bo.agent = opt_agent;
+        bo.system_prompt = opt_system_prompt ? opt_system_prompt : batch_prompt;
+        bo.tool_patterns = batch_tools;
+        bo.tool_approval = opt_tool_approval ? opt_tool_approval : cfg.tool_approval;
+        bo.tool_allowlist = (const char**)cfg.tool_allowlist;
+
+        signal(SIGINT, sigint_handler);
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        int ret = run_batch(&cfg, &bo, errbuf, sizeof(errbuf));
+        curl_global_cleanup();
+        if (ret < 0)
+        {
+            fprintf(stderr, "Error: %s\n", errbuf);
+        }
+        exit_code = ret != 0 ? 1 : 0;
+
+        free(batch_prompt);
+        free_string_list(batch_tools);
+        goto cleanup_cfg;
+    }
+
     /* Build user message */
     int is_tty = isatty(STDIN_FILENO);
     char* prompt = NULL;
@@ -584,11 +685,91 @@ int main(int argc, char** argv)
     int curl_initialized = 0;
     int http_initialized = 0;
     http_client_t http;
+    int engine_initialized = 0;
+    http_engine_t engine;
+    int hedge_initialized = 0;
+    agent_hedge_t hedge;
+    int balance_initialized = 0;
+    balancer_t balance;
+    int limit_initialized = 0;
+    limiter_t limit;
     int agent_initialized = 0;
     agent_t agent;
+    int policy_initialized = 0;
+    policy_t policy;
     loop_result_t result;
     memset(&result, 0, sizeof(result));
 
+    /* Resolve agent config. Errors are reported once we know there is a
+     * prompt, so an empty invocation stays silent. */
+    int ra_status = resolve_agent(&cfg, opt_agent, &ra, errbuf, sizeof(errbuf));
+    ra_loaded = ra_status == 0;
+    int use_http = ra_loaded && !(ra.provider && strcmp(ra.provider, "copilot") == 0);
+
+    /* Start connecting to the provider now, so the DNS lookup and TLS
+     * handshake overlap with reading stdin and attachments below */
+    if (use_http)
+    {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        curl_initialized = 1;
+    }
+    if (use_http && ra.hedge_count > 1)
+    {
+        /* Hedged agent: its members race on one engine */
+        if (http_engine_init(&engine) < 0)
+        {
+            fprintf(stderr, "Error: Failed to start HTTP engine\n");
+            exit_code = 1;
+            goto cleanup_all;
+        }
+        engine_initialized = 1;
+        engine.stall_ms = cfg.stall_timeout * 1000;
+        agent_hedge_init(&hedge, &ra, &engine);
+        hedge_initialized = 1;
+    }
+    else if (use_http)
+    {
+        const char* base_url = ra.base_url;
+        if (!base_url || !base_url[0])
+        {
+            base_url = DEFAULT_BASE_URL;
+        }
+
+        if (http_init(&http, base_url, ra.api_key ? ra.api_key : "") < 0)
+        {
+            fprintf(stderr, "Error: Failed to initialize HTTP client\n");
+            exit_code = 1;
+            goto cleanup_all;
+        }
+        http_initialized = 1;
+        http.retries = cfg.retries;
+        http.stall_ms = cfg.stall_timeout * 1000;
+        http.flags = agent_http_flags(&ra);
+        if (ra.base_urls)
+        {
+            balance_init(&balance, ra.base_urls);
+            balance_initialized = 1;
+            http.balance = &balance;
+        }
+        if (ra.rpm > 0 || ra.tpm > 0 || ra.api_keys)
+        {
+            limit_init(&limit, ra.name, ra.api_keys, ra.api_key, ra.rpm, ra.tpm);
+            limit_initialized = 1;
+            http.limit = &limit;
+        }
+
+        /* A running artd already holds a warm connection; local servers
+         * are cheaper to reach directly, and artd sends bodies uncoded */
+        if (!http_is_local(base_url) && !http.flags && daemon_available())
+        {
+            http.use_daemon = 1;
+        }
+        else
+        {
+            http_warm(&http);
+        }
+    }
+
     prompt = build_user_message(prompt_arg, is_tty, attached_files, attached_count);
 
     if (!prompt || !prompt[0])
@@ -596,14 +777,12 @@ int main(int argc, char** argv)
         goto cleanup_all;
     }
 
-    /* Resolve agent config */
-    if (resolve_agent(&cfg, opt_agent, &ra, errbuf, sizeof(errbuf)) < 0)
+    if (!ra_loaded)
     {
         fprintf(stderr, "Error: %s\n", errbuf);
         exit_code = 1;
         goto cleanup_all;
     }
-    ra_loaded = 1;
 
     /* Resolve system prompt */
     if (opt_system_prompt)
@@ -628,8 +807,17 @@ int main(int argc, char** argv)
     /* Parse tool patterns */
     tool_patterns = parse_tool_patterns(opt_tools);
 
-    /* Determine tool_approval */
+    /* Determine tool_approval and compile the policy deciding tool calls */
     const char* tool_approval = opt_tool_approval ? opt_tool_approval : cfg.tool_approval;
+    if (policy_init(&policy, tool_approval, (const char**)cfg.tool_allowlist, cfg.tool_policy, cfg.tool_policy_count,
+            errbuf, sizeof(errbuf))
+        < 0)
+    {
+        fprintf(stderr, "Error: %s\n", errbuf);
+        exit_code = 1;
+        goto cleanup_all;
+    }
+    policy_initialized = 1;
 
     /* Install SIGINT handler to cancel streaming requests */
     signal(SIGINT, sigint_handler);
@@ -642,16 +830,12 @@ int main(int argc, char** argv)
         spinner_start();
     }
 
-    if (ra.provider && strcmp(ra.provider, "copilot") == 0)
+    if (!use_http)
     {
         /* Copilot path — skip HTTP, use copilot SDK directly */
-        tools_init();
-
         copilot_result_t cp_result;
         int ret = run_copilot_agent(ra.model, system_prompt, prompt,
-            tool_patterns, tool_approval,
-            (const char**)cfg.tool_allowlist,
-            opt_tool_output,
+            tool_patterns, &policy, cfg.shell_session, opt_tool_output,
             print_chunk, print_reasoning_chunk, NULL,
             use_spinner ? spinner_turn_start_cb : NULL,
             use_spinner ? spinner_turn_end_cb : NULL,
@@ -684,41 +868,19 @@ int main(int argc, char** argv)
     }
     else
     {
-        /* HTTP path */
-        curl_global_init(CURL_GLOBAL_DEFAULT);
-        curl_initialized = 1;
-
-        tools_init();
-
-        /* Set up HTTP client */
-        {
-            const char* base_url = ra.base_url;
-            if (!base_url || !base_url[0])
-            {
-                base_url = "https://api.openai.com/v1";
-            }
-
-            if (http_init(&http, base_url, ra.api_key ? ra.api_key : "") < 0)
-            {
-                fprintf(stderr, "Error: Failed to initialize HTTP client\n");
-                exit_code = 1;
-                spinner_stop();
-                goto cleanup_all;
-            }
-            http_initialized = 1;
-        }
+        /* HTTP path; the client was set up and warmed above */
 
         /* Initialize agent */
-        agent_init(&agent, &http, ra.model, system_prompt, tool_patterns);
+        agent_init(&agent, hedge_initialized ? &hedge.routes[0].http : &http, ra.model, system_prompt, tool_patterns);
+        agent.hedge = hedge_initialized ? &hedge : NULL;
         agent_initialized = 1;
 
         /* Run the agent loop */
         {
             int ret = run_agent_loop(&agent, prompt, print_chunk, print_reasoning_chunk, NULL,
                 use_spinner ? spinner_turn_start_cb : NULL,
-                use_spinner ? spinner_turn_end_cb : NULL, tool_approval,
-                (const char**)(cfg.tool_allowlist),
-                opt_tool_output, &result);
+                use_spinner ? spinner_turn_end_cb : NULL, &policy, cfg.tool_workers,
+                (const char**)(cfg.tool_serial), cfg.shell_session, opt_tool_output, &result);
             if (ret < 0 && !g_http_interrupted)
             {
                 exit_code = 1;
@@ -740,6 +902,11 @@ int main(int argc, char** argv)
             char* path = session_save(prompt, system_prompt, ra.model, ra.provider, result.text);
             free(path);
         }
+
+        if (opt_stats)
+        {
+            print_stats(&agent, &result);
+        }
     }
 
 cleanup_all:
@@ -748,13 +915,32 @@ cleanup_all:
     {
         agent_free(&agent);
     }
+    if (policy_initialized)
+    {
+        policy_free(&policy);
+    }
+    if (hedge_initialized)
+    {
+        agent_hedge_free(&hedge);
+    }
+    if (engine_initialized)
+    {
+        http_engine_free(&engine);
+    }
     if (http_initialized)
     {
         http_free(&http);
     }
+    if (balance_initialized)
+    {
+        balance_free(&balance);
+    }
+    if (limit_initialized)
+    {
+        limit_free(&limit);
+    }
     if (curl_initialized)
     {
-        tools_cleanup();
         curl_global_cleanup();
     }
     free(prompt);
@@ -0,0 +1,331 @@
+#include "netcache.h"
+#include "buf.h"
+#include "util.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* SSL session import/export appeared in libcurl 8.12.0 */
+#if LIBCURL_VERSION_NUM >= 0x080c00
+#define NETCACHE_HAVE_SSLS 1
+#endif
+
+static int is_numeric_host(const char* host)
+{
+    unsigned char tmp[sizeof(struct in6_addr)];
+    return host[0] == '[' || inet_pton(AF_INET, host, tmp) == 1 || inet_pton(AF_INET6, host, tmp) == 1;
+}
+
+void netcache_init(netcache_t* nc, const char* url)
+{
+    memset(nc, 0, sizeof(*nc));
+
+    CURLU* u = curl_url();
+    char* host = NULL;
+    char* port = NULL;
+    if (!u || curl_url_set(u, CURLUPART_URL, url, 0) != CURLUE_OK
+        || curl_url_get(u, CURLUPART_HOST, &host, 0) != CURLUE_OK
+        || curl_url_get(u, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT) != CURLUE_OK || !host[0]
+        || is_numeric_host(host) || strcmp(host, "localhost") == 0)
+    {
+        curl_free(host);
+        curl_free(port);
+        curl_url_cleanup(u);
+        return;
+    }
+    nc->host = strdup(host);
+    nc->port = strtol(port, NULL, 10);
+    curl_free(host);
+    curl_free(port);
+    curl_url_cleanup(u);
+
+    /* Host names are [A-Za-z0-9.-] after IDN conversion; be safe anyway */
+    buf_t name = { 0 };
+    buf_printf(&name, "/.artifice/cache/net/%s-%ld", nc->host, nc->port);
+    for (char* p = name.data + strlen("/.artifice/cache/net/"); *p; p++)
+    {
+        if (!(*p == '.' || *p == '-' || (*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'z')
+                || (*p >= 'A' && *p <= 'Z')))
+        {
+            *p = '_';
+        }
+    }
+    nc->path = home_path(name.data);
+    buf_free(&name);
+}
+
+void netcache_free(netcache_t* nc)
+{
+    curl_slist_free_all(nc->resolve);
+    if (nc->share)
+    {
+        curl_share_cleanup(nc->share);
+    }
+    free(nc->path);
+    free(nc->host);
+    free(nc->addr);
+    memset(nc, 0, sizeof(*nc));
+}
+
+/* ---- Hex encoding ---- */
+
+#ifdef NETCACHE_HAVE_SSLS
+static void hex_encode(FILE* f, const unsigned char* p, size_t len)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++)
+    {
+        fputc(digits[p[i] >> 4], f);
+        fputc(digits[p[i] & 0xF], f);
+    }
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/* Decode hex in place. Returns the decoded length, or -1 if malformed. */
+static long hex_decode(char* s)
+{
+    size_t len = strlen(s);
+    if (len % 2)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < len / 2; i++)
+    {
+        int hi = hex_value(s[2 * i]);
+        int lo = hex_value(s[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+        {
+            return -1;
+        }
+        s[i] = (char)(hi << 4 | lo);
+    }
+    return (long)(len / 2);
+}
+#endif
+
+/* ---- Load ---- */
+
+static void pin_addr(netcache_t* nc, CURL* curl, const char* addr, time_t expires)
+{
+    buf_t entry = { 0 };
+    /* IPv6 addresses must be bracketed in CURLOPT_RESOLVE entries */
+    if (strchr(addr, ':'))
+    {
+        buf_printf(&entry, "%s:%ld:[%s]", nc->host, nc->port, addr);
+    }
+    else
+    {
+        buf_printf(&entry, "%s:%ld:%s", nc->host, nc->port, addr);
+    }
+    nc->resolve = curl_slist_append(nc->resolve, entry.data);
+    buf_free(&entry);
+    curl_easy_setopt(curl, CURLOPT_RESOLVE, nc->resolve);
+    nc->pinned = 1;
+
+    free(nc->addr);
+    nc->addr = strdup(addr);
+    nc->addr_expires = expires;
+}
+
+void netcache_apply(netcache_t* nc, CURL* curl)
+{
+    if (!nc->path)
+    {
+        return;
+    }
+
+#ifdef NETCACHE_HAVE_SSLS
+    /* Session export works on a shared session cache */
+    nc->share = curl_share_init();
+    if (nc->share)
+    {
+        curl_share_setopt(nc->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_easy_setopt(curl, CURLOPT_SHARE, nc->share);
+    }
+#endif
+
+    FILE* f = fopen(nc->path, "r");
+    if (!f)
+    {
+        return;
+    }
+
+    time_t now = time(NULL);
+    char* line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, f) > 0)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        char* save = NULL;
+        char* kind = strtok_r(line, " ", &save);
+        char* exp = strtok_r(NULL, " ", &save);
+        time_t expires = exp ? (time_t)strtoll(exp, NULL, 10) : 0;
+        if (!kind || expires <= now)
+        {
+            continue;
+        }
+
+        if (strcmp(kind, "addr") == 0 && !nc->pinned)
+        {
+            char* addr = strtok_r(NULL, " ", &save);
+            unsigned char tmp[sizeof(struct in6_addr)];
+            if (addr && (inet_pton(AF_INET, addr, tmp) == 1 || inet_pton(AF_INET6, addr, tmp) == 1))
+            {
+                pin_addr(nc, curl, addr, expires);
+            }
+        }
+#ifdef NETCACHE_HAVE_SSLS
+        else if (strcmp(kind, "tls") == 0)
+        {
+            char* shmac = strtok_r(NULL, " ", &save);
+            char* sdata = strtok_r(NULL, " ", &save);
+            long shmac_len = shmac ? hex_decode(shmac) : -1;
+            long sdata_len = sdata ? hex_decode(sdata) : -1;
+            if (shmac_len > 0 && sdata_len > 0)
+            {
+                curl_easy_ssls_import(curl, NULL, (const unsigned char*)shmac, (size_t)shmac_len,
+                    (const unsigned char*)sdata, (size_t)sdata_len);
+            }
+        }
+#endif
+    }
+    free(line);
+    fclose(f);
+}
+
+/* ---- Update ---- */
+
+void netcache_note_success(netcache_t* nc, CURL* curl)
+{
+    if (!nc->path)
+    {
+        return;
+    }
+    char* ip = NULL;
+    if (curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &ip) != CURLE_OK || !ip || !ip[0])
+    {
+        return;
+    }
+    /* Reusing a pinned address must not extend its lifetime */
+    if (nc->addr && strcmp(nc->addr, ip) == 0)
+    {
+        return;
+    }
+    free(nc->addr);
+    nc->addr = strdup(ip);
+    nc->addr_expires = time(NULL) + NETCACHE_ADDR_TTL;
+}
+
+void netcache_unpin(netcache_t* nc, CURL* curl)
+{
+    if (!nc->pinned)
+    {
+        return;
+    }
+    /* A "-host:port" entry evicts the address from curl's DNS cache */
+    buf_t entry = { 0 };
+    buf_printf(&entry, "-%s:%ld", nc->host, nc->port);
+    curl_slist_free_all(nc->resolve);
+    nc->resolve = curl_slist_append(NULL, entry.data);
+    buf_free(&entry);
+    curl_easy_setopt(curl, CURLOPT_RESOLVE, nc->resolve);
+    nc->pinned = 0;
+
+    free(nc->addr);
+    nc->addr = NULL;
+    nc->addr_expires = 0;
+}
+
+/* ---- Save ---- */
+
+#ifdef NETCACHE_HAVE_SSLS
+static CURLcode export_session(CURL* curl, void* userptr, const char* session_key, const unsigned char* shmac,
+    size_t shmac_len, const unsigned char* sdata, size_t sdata_len, curl_off_t valid_until, int ietf_tls_id,
+    const char* alpn, size_t earlydata_max)
+{
+    FILE* f = userptr;
+    (void)curl;
+    (void)session_key;
+    (void)ietf_tls_id;
+    (void)alpn;
+    (void)earlydata_max;
+
+    time_t cap = time(NULL) + NETCACHE_TLS_TTL;
+    time_t expires = valid_until > 0 && (time_t)valid_until < cap ? (time_t)valid_until : cap;
+    if (!shmac || !shmac_len || !sdata || !sdata_len)
+    {
+        return CURLE_OK;
+    }
+    fprintf(f, "tls %lld ", (long long)expires);
+    hex_encode(f, shmac, shmac_len);
+    fputc(' ', f);
+    hex_encode(f, sdata, sdata_len);
+    fputc('\n', f);
+    return CURLE_OK;
+}
+#endif
+
+void netcache_save(netcache_t* nc, CURL* curl)
+{
+    if (!nc->path || !nc->addr)
+    {
+        return;
+    }
+
+    /* The files hold TLS session tickets: keep their directory to
+     * ourselves, also if an older version created it 0755 */
+    buf_t tmp = { 0 };
+    buf_append(&tmp, nc->path, (size_t)(strrchr(nc->path, '/') - nc->path));
+    mkdir_parents(tmp.data);
+    if (mkdir(tmp.data, 0700) != 0)
+    {
+        chmod(tmp.data, 0700);
+    }
+
+    /* Write a private temp file and rename it over the old one, so parallel
+     * invocations never see a torn file. It is 0600 from the start: an fd
+     * opened before a later chmod would keep reading it. */
+    buf_clear(&tmp);
+    buf_printf(&tmp, "%s.%ld.tmp", nc->path, (long)getpid());
+    unlink(tmp.data); /* left by a crashed process with our pid */
+    int fd = open(tmp.data, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    FILE* f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(tmp.data);
+        }
+        buf_free(&tmp);
+        return;
+    }
+    fprintf(f, "addr %lld %s\n", (long long)nc->addr_expires, nc->addr);
+#ifdef NETCACHE_HAVE_SSLS
+    curl_easy_ssls_export(curl, export_session, f);
+#else
+    (void)curl;
+#endif
+    if (fclose(f) != 0 || rename(tmp.data, nc->path) != 0)
+    {
+        unlink(tmp.data);
+    }
+    buf_free(&tmp);
+}
@@ -0,0 +1,51 @@
+#ifndef NETCACHE_H
+#define NETCACHE_H
+
+#include <curl/curl.h>
+#include <time.h>
+
+/* On-disk cache of connection state for one provider host, so that
+ * back-to-back invocations skip DNS and resume TLS sessions.
+ *
+ * Stored in ~/.artifice/cache/net/<host>-<port>, one entry per line:
+ *
+ *     addr <expires> <address>
+ *     tls <expires> <shmac hex> <session hex>
+ *
+ * The address is fed to curl via CURLOPT_RESOLVE. TLS sessions are only
+ * persisted with libcurl 8.12+ (curl_easy_ssls_import/export). */
+
+#define NETCACHE_ADDR_TTL 600 /* seconds a resolved address is trusted */
+#define NETCACHE_TLS_TTL (24 * 3600) /* upper bound for a saved session */
+
+typedef struct
+{
+    char* path; /* NULL if caching is disabled for this URL */
+    char* host;
+    long port;
+    char* addr; /* address to save, from the last successful transfer */
+    time_t addr_expires;
+    struct curl_slist* resolve; /* CURLOPT_RESOLVE list, if pinned */
+    int pinned; /* the handle resolves host from the cache */
+    CURLSH* share; /* SSL session cache, when sessions are persisted */
+} netcache_t;
+
+/* Derive the cache file for url. Caching is disabled (path NULL) for
+ * numeric hosts or when HOME is unset. */
+void netcache_init(netcache_t* nc, const char* url);
+void netcache_free(netcache_t* nc);
+
+/* Load the cache file and configure curl: pin the cached address and
+ * import unexpired TLS sessions. */
+void netcache_apply(netcache_t* nc, CURL* curl);
+
+/* Remember the address curl connected to in its last transfer. */
+void netcache_note_success(netcache_t* nc, CURL* curl);
+
+/* Drop the pinned address, e.g. after a connect failure. */
+void netcache_unpin(netcache_t* nc, CURL* curl);
+
+/* Write the noted address and curl's TLS sessions back to disk. */
+void netcache_save(netcache_t* nc, CURL* curl);
+
+#endif
@@ -0,0 +1,353 @@
+#include "policy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void* xcalloc(size_t n, size_t size)
+{
+    void* p = calloc(n ? n : 1, size);
+    if (!p)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/* Canonical form of a rule's path or scope, without a trailing slash */
+static char* canonical_prefix(const char* path)
+{
+    char* c = tools_canonical_path(path);
+    size_t len = strlen(c);
+    while (len > 1 && c[len - 1] == '/')
+    {
+        c[--len] = '\0';
+    }
+    return c;
+}
+
+static int under(const char* path, const char* prefix)
+{
+    size_t len = strlen(prefix);
+    if (strcmp(prefix, "/") == 0)
+    {
+        return path[0] == '/';
+    }
+    return strncmp(path, prefix, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+/* A path that still has . or .. components went through a directory that
+ * does not exist yet, so where it ends up is unknown */
+static int is_clean(const char* path)
+{
+    for (const char* p = strstr(path, "/."); p; p = strstr(p + 1, "/."))
+    {
+        if (p[2] == '/' || p[2] == '\0' || (p[2] == '.' && (p[3] == '/' || p[3] == '\0')))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void free_rules(policy_rule_t* rules, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (rules[i].paths)
+        {
+            for (char** s = rules[i].paths; *s; s++)
+            {
+                free(*s);
+            }
+            free(rules[i].paths);
+        }
+        if (rules[i].has_command)
+        {
+            regfree(&rules[i].command);
+        }
+    }
+    free(rules);
+}
+
+int policy_init(policy_t* p, const char* mode, const char** allowlist, const policy_rule_def_t* rules, int count,
+    char* errbuf, size_t errlen)
+{
+    memset(p, 0, sizeof(*p));
+    p->mode = mode ? mode : "ask";
+    p->tools = tools_list(&p->tool_count);
+
+    char cwd[4096];
+    char* here = getcwd(cwd, sizeof(cwd)) ? canonical_prefix(cwd) : NULL;
+
+    /* Compile the rules in scope, remembering which definition each is */
+    p->rules = xcalloc((size_t)count, sizeof(policy_rule_t));
+    int* def_of = xcalloc((size_t)count, sizeof(int));
+    for (int i = 0; i < count; i++)
+    {
+        const policy_rule_def_t* d = &rules[i];
+        if (d->allow < 0 || !d->tools || !d->tools[0])
+        {
+            snprintf(errbuf, errlen, "tool_policy rule %d: needs one of allow or deny, naming tools", i + 1);
+            goto fail;
+        }
+        if (d->scope)
+        {
+            char* scope = canonical_prefix(d->scope);
+            int in_scope = here && under(here, scope);
+            free(scope);
+            if (!in_scope)
+            {
+                continue;
+            }
+        }
+        policy_rule_t* r = &p->rules[p->rule_count];
+        memset(r, 0, sizeof(*r));
+        r->allow = d->allow;
+        if (d->command)
+        {
+            int rc = regcomp(&r->command, d->command, REG_EXTENDED | REG_NOSUB);
+            if (rc != 0)
+            {
+                char msg[128];
+                regerror(rc, &r->command, msg, sizeof(msg));
+                snprintf(errbuf, errlen, "tool_policy rule %d: bad command regex: %s", i + 1, msg);
+                goto fail;
+            }
+            r->has_command = 1;
+        }
+        if (d->paths)
+        {
+            int n = 0;
+            while (d->paths[n])
+            {
+                n++;
+            }
+            r->paths = xcalloc((size_t)n + 1, sizeof(char*));
+            for (int k = 0; k < n; k++)
+            {
+                r->paths[k] = canonical_prefix(d->paths[k]);
+            }
+        }
+        def_of[p->rule_count++] = i;
+    }
+
+    /* Per tool: its rules, deny before allow, so the first match decides */
+    p->by_tool = xcalloc((size_t)p->tool_count, sizeof(int*));
+    p->by_tool_count = xcalloc((size_t)p->tool_count, sizeof(int));
+    p->allowlisted = xcalloc((size_t)p->tool_count, 1);
+    p->always = xcalloc((size_t)p->tool_count, 1);
+    for (int t = 0; t < p->tool_count; t++)
+    {
+        const tool_def_t* tool = &p->tools[t];
+        p->by_tool[t] = xcalloc((size_t)p->rule_count, sizeof(int));
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (int i = 0; i < p->rule_count; i++)
+            {
+                if (p->rules[i].allow == pass && tools_match(tool, (const char**)rules[def_of[i]].tools))
+                {
+                    p->by_tool[t][p->by_tool_count[t]++] = i;
+                }
+            }
+        }
+        p->allowlisted[t] = allowlist && tools_match(tool, allowlist);
+    }
+
+    free(def_of);
+    free(here);
+    pthread_mutex_init(&p->lock, NULL);
+    return 0;
+
+fail:
+    free_rules(p->rules, p->rule_count);
+    free(def_of);
+    free(here);
+    memset(p, 0, sizeof(*p));
+    return -1;
+}
+
+void policy_free(policy_t* p)
+{
+    free_rules(p->rules, p->rule_count);
+    for (int t = 0; t < p->tool_count && p->by_tool; t++)
+    {
+        free(p->by_tool[t]);
+    }
+    free(p->by_tool);
+    free(p->by_tool_count);
+    free(p->allowlisted);
+    free(p->always);
+    pthread_mutex_destroy(&p->lock);
+    memset(p, 0, sizeof(*p));
+}
+
+static const char* string_arg(const cJSON* args, const char* key)
+{
+    cJSON* j = cJSON_GetObjectItem(args, key);
+    return j && cJSON_IsString(j) ? j->valuestring : NULL;
+}
+
+static int rule_matches(const policy_rule_t* r, const char* path, const char* command)
+{
+    if (r->paths)
+    {
+        if (!path)
+        {
+            return 0;
+        }
+        /* An unknown destination never satisfies an allow, always a deny */
+        int hit = !r->allow && !is_clean(path);
+        for (char** s = r->paths; *s && !hit; s++)
+        {
+            hit = is_clean(path) && under(path, *s);
+        }
+        if (!hit)
+        {
+            return 0;
+        }
+    }
+    if (r->has_command && (!command || regexec(&r->command, command, 0, NULL, 0) != 0))
+    {
+        return 0;
+    }
+    /* The regex sees one string, the shell several lines: a command with a
+     * line break could run anything after it, so no allow covers it */
+    if (r->has_command && r->allow && strpbrk(command, "\r\n"))
+    {
+        return 0;
+    }
+    return 1;
+}
+
+int policy_decide(policy_t* p, const char* name, const cJSON* args)
+{
+    const tool_def_t* tool = tools_find(name);
+    int t = tool ? (int)(tool - p->tools) : -1;
+
+    if (t >= 0 && p->by_tool_count[t] > 0)
+    {
+        const char* path_arg = string_arg(args, "path");
+        char* path = path_arg ? tools_canonical_path(path_arg) : NULL;
+        const char* command = string_arg(args, "command");
+        int decision = -1;
+        for (int k = 0; k < p->by_tool_count[t] && decision < 0; k++)
+        {
+            const policy_rule_t* r = &p->rules[p->by_tool[t][k]];
+            if (rule_matches(r, path, command))
+            {
+                decision = r->allow ? POLICY_ALLOW : POLICY_DENY;
+            }
+        }
+        free(path);
+        if (decision >= 0)
+        {
+            return decision;
+        }
+    }
+
+    if (strcmp(p->mode, "auto") == 0)
+    {
+        return POLICY_ALLOW;
+    }
+    if (strcmp(p->mode, "deny") == 0)
+    {
+        return POLICY_DENY;
+    }
+    if (t >= 0 && p->allowlisted[t])
+    {
+        return POLICY_ALLOW;
+    }
+    int always = 0;
+    if (t >= 0)
+    {
+        pthread_mutex_lock(&p->lock);
+        always = p->always[t];
+        pthread_mutex_unlock(&p->lock);
+    }
+    return always ? POLICY_ALLOW : POLICY_ASK;
+}
+
+int policy_check(policy_t* p, const char* name, const cJSON* args, int* cancel)
+{
+    if (cancel)
+    {
+        *cancel = 0;
+    }
+    int decision = policy_decide(p, name, args);
+    if (decision != POLICY_ASK)
+    {
+        return decision == POLICY_ALLOW;
+    }
+
+    /* Interactive approval */
+    fprintf(stderr, "\nTool Call: %s\n", name);
+    if (args)
+    {
+        char* args_str = cJSON_Print(args);
+        if (args_str)
+        {
+            fprintf(stderr, "   Arguments: %s\n", args_str);
+        }
+        free(args_str);
+    }
+
+    while (1)
+    {
+        fprintf(stderr, cancel ? "\nApprove this tool call? [Y]es [N]o [A]lways [C]ancel: "
+                               : "\nApprove this tool call? [Y]es [N]o [A]lways: ");
+        fflush(stderr);
+
+        char line[64];
+        if (!fgets(line, sizeof(line), stdin))
+        {
+            if (cancel)
+            {
+                fprintf(stderr, "\nOperation cancelled.\n");
+                *cancel = 1;
+            }
+            return 0;
+        }
+
+        /* Strip whitespace */
+        char* s = line;
+        while (*s == ' ' || *s == '\t')
+        {
+            s++;
+        }
+        char c = *s;
+        if (c >= 'A' && c <= 'Z')
+        {
+            c += 32; /* tolower */
+        }
+
+        if (c == 'y')
+        {
+            return 1;
+        }
+        if (c == 'n')
+        {
+            return 0;
+        }
+        if (c == 'a')
+        {
+            const tool_def_t* tool = tools_find(name);
+            if (tool)
+            {
+                pthread_mutex_lock(&p->lock);
+                p->always[tool - p->tools] = 1;
+                pthread_mutex_unlock(&p->lock);
+            }
+            return 1;
+        }
+        if (c == 'c' && cancel)
+        {
+            *cancel = 1;
+            return 0;
+        }
+        fprintf(stderr, cancel ? "Invalid response. Please enter Y, N, A, or C.\n"
+                               : "Invalid response. Please enter Y, N, or A.\n");
+    }
+}
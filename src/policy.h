@@ -0,0 +1,67 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include "config.h"
+#include "tools.h"
+
+#include <cJSON.h>
+#include <pthread.h>
+#include <regex.h>
+
+/* Tool approval, shared by the HTTP runner and the copilot agent.
+ *
+ * The tool_policy rules of the configuration are checked first: a call
+ * matched by any deny rule is refused, else one matched by an allow rule
+ * runs without asking. A rule matches by tool name (fnmatch), and can also
+ * require the call's "path" to lie under one of its prefixes and its
+ * "command" to match a regex; a scoped rule only exists while the current
+ * directory is inside its scope. Calls no rule matches fall to the mode:
+ * "auto" allows them, "deny" refuses them, and "ask" allows those on the
+ * allowlist or chosen "always" and prompts for the rest.
+ *
+ * Everything is compiled up front by policy_init(): paths are made
+ * canonical, regexes compiled and each built-in tool given the list of
+ * rules that can apply to it, so a check touches only those. */
+
+#define POLICY_DENY 0
+#define POLICY_ALLOW 1
+#define POLICY_ASK 2 /* only in "ask" mode */
+
+typedef struct
+{
+    int allow;
+    char** paths; /* canonical prefixes, NULL = any */
+    regex_t command;
+    int has_command;
+} policy_rule_t;
+
+typedef struct
+{
+    const char* mode; /* "ask", "auto", "deny" */
+    policy_rule_t* rules;
+    int rule_count;
+    const tool_def_t* tools; /* the registry, indexed like the arrays below */
+    int tool_count;
+    int** by_tool; /* rule indices per tool, deny rules first */
+    int* by_tool_count;
+    char* allowlisted; /* per tool, matched by the allowlist */
+    char* always; /* per tool, chosen "always" at a prompt; guarded by lock */
+    pthread_mutex_t lock;
+} policy_t;
+
+/* Compile rules for the given mode and allowlist (NULL-terminated fnmatch
+ * patterns, may be NULL). Returns 0, or -1 with errbuf set if a rule is
+ * malformed; p then needs no policy_free(). */
+int policy_init(policy_t* p, const char* mode, const char** allowlist, const policy_rule_def_t* rules, int count,
+    char* errbuf, size_t errlen);
+void policy_free(policy_t* p);
+
+/* Decide a call of tool name without prompting. Safe from any thread. */
+int policy_decide(policy_t* p, const char* name, const cJSON* args);
+
+/* Decide a call, prompting on the terminal if the policy says to ask.
+ * Returns 1 if it may run. If cancel is non-NULL the prompt also offers to
+ * cancel the session, which sets *cancel and returns 0. */
+int policy_check(policy_t* p, const char* name, const cJSON* args, int* cancel);
+
+#endif
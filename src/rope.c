@@ -0,0 +1,119 @@
+#include "rope.h"
+
+#include <string.h>
+
+void rope_init(rope_t* r, arena_t* arena)
+{
+    memset(r, 0, sizeof(*r));
+    r->arena = arena;
+}
+
+void rope_ref(rope_t* r, const void* p, size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+    r->len += len;
+
+    /* Coalesce with the previous segment when contiguous */
+    if (r->count > 0)
+    {
+        struct iovec* last = &r->iov[r->count - 1];
+        if ((const char*)last->iov_base + last->iov_len == (const char*)p)
+        {
+            last->iov_len += len;
+            return;
+        }
+    }
+    if (r->count >= r->cap)
+    {
+        int cap = r->cap ? r->cap * 2 : 16;
+        r->iov = arena_grow(r->arena, r->iov, (size_t)r->cap * sizeof(struct iovec), (size_t)cap * sizeof(struct iovec));
+        r->cap = cap;
+    }
+    r->iov[r->count].iov_base = (void*)p;
+    r->iov[r->count].iov_len = len;
+    r->count++;
+}
+
+void rope_ref_str(rope_t* r, const char* s)
+{
+    if (s)
+    {
+        rope_ref(r, s, strlen(s));
+    }
+}
+
+void rope_append(rope_t* r, const void* p, size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+    char* copy = arena_alloc(r->arena, len);
+    memcpy(copy, p, len);
+    rope_ref(r, copy, len);
+}
+
+void rope_init_ref(rope_t* r, struct iovec* iov, const void* p, size_t len)
+{
+    iov->iov_base = (void*)p;
+    iov->iov_len = len;
+    r->iov = iov;
+    r->count = len > 0;
+    r->cap = 1;
+    r->len = len;
+    r->arena = NULL;
+}
+
+void rope_reader_init(rope_reader_t* rd, const rope_t* r)
+{
+    rd->rope = r;
+    rd->seg = 0;
+    rd->seg_off = 0;
+    rd->pos = 0;
+}
+
+size_t rope_read(rope_reader_t* rd, char* dst, size_t n)
+{
+    const rope_t* r = rd->rope;
+    size_t done = 0;
+    while (done < n && rd->seg < r->count)
+    {
+        const struct iovec* v = &r->iov[rd->seg];
+        size_t take = v->iov_len - rd->seg_off;
+        if (take > n - done)
+        {
+            take = n - done;
+        }
+        memcpy(dst + done, (const char*)v->iov_base + rd->seg_off, take);
+        done += take;
+        rd->seg_off += take;
+        if (rd->seg_off == v->iov_len)
+        {
+            rd->seg++;
+            rd->seg_off = 0;
+        }
+    }
+    rd->pos += done;
+    return done;
+}
+
+int rope_seek(rope_reader_t* rd, size_t off)
+{
+    const rope_t* r = rd->rope;
+    if (off > r->len)
+    {
+        return -1;
+    }
+    rd->seg = 0;
+    rd->pos = off;
+    while (rd->seg < r->count && off >= r->iov[rd->seg].iov_len)
+    {
+        off -= r->iov[rd->seg].iov_len;
+        rd->seg++;
+    }
+    rd->seg_off = off;
+    return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef ROPE_H
+#define ROPE_H
+
+#include "arena.h"
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+/* Segmented byte string: an ordered list of iovecs that refer to existing
+ * memory instead of copying it. Used to assemble request bodies from large
+ * pieces (the history wire buffer, tool schemas) without concatenating them.
+ *
+ * All rope storage (the iovec array and any copied bytes) comes from the
+ * arena passed to rope_init() and is released with it; there is no
+ * rope_free(). Referenced memory must outlive the rope. */
+typedef struct
+{
+    struct iovec* iov;
+    int count;
+    int cap;
+    size_t len; /* total bytes */
+    arena_t* arena;
+} rope_t;
+
+/* Sequential reader over a rope, e.g. for a curl read callback. */
+typedef struct
+{
+    const rope_t* rope;
+    int seg; /* current segment */
+    size_t seg_off; /* offset within it */
+    size_t pos; /* absolute offset */
+} rope_reader_t;
+
+void rope_init(rope_t* r, arena_t* arena);
+
+/* Append a reference to len bytes at p. Nothing is copied. */
+void rope_ref(rope_t* r, const void* p, size_t len);
+void rope_ref_str(rope_t* r, const char* s);
+
+/* Append a copy of len bytes at p, for short-lived or small pieces. */
+void rope_append(rope_t* r, const void* p, size_t len);
+
+/* Make r a one-segment rope over len bytes at p, with *iov as its only
+ * storage, for callers without an arena. Nothing may be added to it. */
+void rope_init_ref(rope_t* r, struct iovec* iov, const void* p, size_t len);
+
+void rope_reader_init(rope_reader_t* rd, const rope_t* r);
+
+/* Copy up to n bytes into dst. Returns bytes copied, 0 at the end. */
+size_t rope_read(rope_reader_t* rd, char* dst, size_t n);
+
+/* Reposition to absolute offset off. Returns 0, or -1 if off > len. */
+int rope_seek(rope_reader_t* rd, size_t off);
+
+#endif
@@ -1,219 +1,264 @@
 #include "runner.h"
 #include "buf.h"
+#include "policy.h"
+#include "shell.h"
+#include "toolpool.h"
 #include "tools.h"
+#include "util.h"
 
 #include <cJSON.h>
-#include <fnmatch.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define MAX_TOOL_TURNS 50
 
-/* ---- Tool Approver ---- */
-
-typedef struct
-{
-    const char* mode; /* "ask", "auto", "deny" */
-    const char** allowlist; /* fnmatch patterns, NULL-terminated */
-    char** always_allowed; /* dynamically grown set */
-    int always_count;
-    int always_cap;
-} approver_t;
-
-static void approver_init(approver_t* ap, const char* mode, const char** allowlist)
-{
-    ap->mode = mode ? mode : "ask";
-    ap->allowlist = allowlist;
-    ap->always_allowed = NULL;
-    ap->always_count = 0;
-    ap->always_cap = 0;
-}
-
-static void approver_free(approver_t* ap)
-{
-    for (int i = 0; i < ap->always_count; i++)
-    {
-        free(ap->always_allowed[i]);
-    }
-    free(ap->always_allowed);
-}
+/* ---- Format tool args for display ---- */
 
-static int approver_is_allowed(approver_t* ap, const char* name)
+static void format_tool_args(const tool_call_t* tc, buf_t* out)
 {
-    if (strcmp(ap->mode, "auto") == 0)
-    {
-        return 1;
-    }
-    if (strcmp(ap->mode, "deny") == 0)
+    if (!tc->args)
     {
-        return 0;
+        return;
     }
-
-    /* Check allowlist patterns */
-    if (ap->allowlist)
+    cJSON* item = NULL;
+    int first = 1;
+    cJSON_ArrayForEach(item, tc->args)
     {
-        for (const char** p = ap->allowlist; *p; p++)
+        if (!first)
+        {
+            buf_append_str(out, " ");
+        }
+        first = 0;
+        buf_append_str(out, item->string);
+        buf_append_str(out, "=");
+        if (cJSON_IsString(item))
         {
-            if (fnmatch(*p, name, 0) == 0)
+            size_t len = strlen(item->valuestring);
+            if (len > 40)
             {
-                return 1;
+                buf_append_str(out, "\"");
+                buf_append(out, item->valuestring, 37);
+                buf_append_str(out, "...\"");
+            }
+            else
+            {
+                buf_printf(out, "\"%s\"", item->valuestring);
             }
         }
+        else if (cJSON_IsNumber(item))
+        {
+            buf_printf(out, "%g", item->valuedouble);
+        }
+        else
+        {
+            buf_append_str(out, "...");
+        }
     }
+}
 
-    /* Check always-allowed set */
-    for (int i = 0; i < ap->always_count; i++)
+/* ---- Speculative Tool Calls ---- */
+
+/* Read-only calls that need no prompt start on the pool as soon as their
+ * arguments have streamed, while the model is still generating. Only an
+ * unbroken run from the first call of a response qualifies, so the pool
+ * still receives calls in their order. */
+typedef struct
+{
+    policy_t* policy;
+    tool_pool_t* pool;
+    int count; /* calls 0..count-1 are on the pool */
+    int closed; /* a call did not qualify, so later ones wait for the response */
+    int cap;
+    int* job;
+    char** name;
+    char** raw_args;
+    cJSON** args; /* owned, borrowed by the pool until it is cleared */
+} speculation_t;
+
+static void speculation_init(speculation_t* sp, policy_t* policy, tool_pool_t* pool)
+{
+    memset(sp, 0, sizeof(*sp));
+    sp->policy = policy;
+    sp->pool = pool;
+}
+
+/* Forget this response's calls; the pool must have been cleared. */
+static void speculation_reset(speculation_t* sp)
+{
+    for (int i = 0; i < sp->count; i++)
     {
-        if (strcmp(ap->always_allowed[i], name) == 0)
-        {
-            return 1;
-        }
+        free(sp->name[i]);
+        free(sp->raw_args[i]);
+        cJSON_Delete(sp->args[i]);
     }
+    sp->count = 0;
+    sp->closed = 0;
+}
 
-    return 0;
+static void speculation_free(speculation_t* sp)
+{
+    speculation_reset(sp);
+    free(sp->job);
+    free(sp->name);
+    free(sp->raw_args);
+    free(sp->args);
 }
 
-static void approver_add_always(approver_t* ap, const char* name)
+/* tool_ready_fn; runs on the engine thread for hedged agents, but never
+ * alongside the runner, which is blocked in agent_send() meanwhile */
+static void speculate(int index, const char* name, const char* raw_args, void* userdata)
 {
-    if (ap->always_count >= ap->always_cap)
+    speculation_t* sp = userdata;
+    const tool_def_t* t = tools_find(name);
+    if (sp->closed || index != sp->count || !t || !(t->flags & TOOL_READONLY))
     {
-        ap->always_cap = ap->always_cap ? ap->always_cap * 2 : 4;
-        char** tmp = realloc(ap->always_allowed, (size_t)ap->always_cap * sizeof(char*));
-        if (!tmp)
+        sp->closed = 1;
+        return;
+    }
+    cJSON* args = cJSON_Parse(raw_args);
+    if (!args || policy_decide(sp->policy, name, args) != POLICY_ALLOW)
+    {
+        cJSON_Delete(args);
+        sp->closed = 1;
+        return;
+    }
+    if (sp->count >= sp->cap)
+    {
+        sp->cap = sp->cap ? sp->cap * 2 : 8;
+        sp->job = realloc(sp->job, (size_t)sp->cap * sizeof(int));
+        sp->name = realloc(sp->name, (size_t)sp->cap * sizeof(char*));
+        sp->raw_args = realloc(sp->raw_args, (size_t)sp->cap * sizeof(char*));
+        sp->args = realloc(sp->args, (size_t)sp->cap * sizeof(cJSON*));
+        if (!sp->job || !sp->name || !sp->raw_args || !sp->args)
         {
             fprintf(stderr, "Out of memory\n");
             exit(1);
         }
-        ap->always_allowed = tmp;
     }
-    char* s = strdup(name);
-    if (!s)
+    int n = sp->count++;
+    sp->name[n] = strdup(name);
+    sp->raw_args[n] = strdup(raw_args);
+    if (!sp->name[n] || !sp->raw_args[n])
     {
         fprintf(stderr, "Out of memory\n");
         exit(1);
     }
-    ap->always_allowed[ap->always_count++] = s;
+    sp->args[n] = args;
+    sp->job[n] = tool_pool_submit(sp->pool, name, args);
 }
 
-/* Returns: 1 = allowed, 0 = denied. Sets *continue_session = 0 on abort. */
-static int approver_check(approver_t* ap, const tool_call_t* tc, int* continue_session)
+/* The pool job already running call i, or -1 if it was not started early
+ * or the final call differs from what had streamed by then. */
+static int speculation_job(const speculation_t* sp, int i, const tool_call_t* tc)
 {
-    *continue_session = 1;
-
-    if (approver_is_allowed(ap, tc->name))
+    if (i >= sp->count || strcmp(sp->name[i], tc->name) != 0 || !tc->raw_args)
     {
-        return 1;
+        return -1;
     }
-
-    /* Interactive approval */
-    fprintf(stderr, "\nTool Call: %s\n", tc->name);
-    if (tc->args)
+    size_t len = strlen(sp->raw_args[i]);
+    if (strncmp(sp->raw_args[i], tc->raw_args, len) != 0)
     {
-        char* args_str = cJSON_Print(tc->args);
-        fprintf(stderr, "   Arguments: %s\n", args_str);
-        free(args_str);
+        return -1;
     }
-
-    while (1)
+    /* Only whitespace may follow the closing bracket */
+    for (const char* p = tc->raw_args + len; *p; p++)
     {
-        fprintf(stderr, "\nApprove this tool call? [Y]es [N]o [A]lways [C]ancel: ");
-        fflush(stderr);
-
-        char line[64];
-        if (!fgets(line, sizeof(line), stdin))
+        if (*p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
         {
-            fprintf(stderr, "\nOperation cancelled.\n");
-            *continue_session = 0;
-            return 0;
+            return -1;
         }
+    }
+    return sp->job[i];
+}
 
-        /* Strip whitespace */
-        char* p = line;
-        while (*p == ' ' || *p == '\t')
-        {
-            p++;
-        }
-        char c = *p;
-        if (c >= 'A' && c <= 'Z')
-        {
-            c += 32; /* tolower */
-        }
+/* ---- Agent Loop ---- */
 
-        if (c == 'y')
-        {
-            return 1;
-        }
-        if (c == 'n')
-        {
-            return 0;
-        }
-        if (c == 'a')
-        {
-            approver_add_always(ap, tc->name);
-            return 1;
-        }
-        if (c == 'c')
+/* Record a failed agent_send() in out, keeping any text it had already
+ * streamed, which the user has seen. */
+static void report_send_error(const agent_response_t* resp, buf_t* final_text, loop_result_t* out)
+{
+    if (resp->partial)
+    {
+        /* The streamed text left the cursor mid-line */
+        fprintf(stderr, "\n");
+        if (resp->text)
         {
-            *continue_session = 0;
-            return 0;
+            buf_append_str(final_text, resp->text);
         }
-        fprintf(stderr, "Invalid response. Please enter Y, N, A, or C.\n");
+        out->partial = 1;
     }
+    if (resp->error && resp->error[0])
+    {
+        fprintf(stderr, resp->partial ? "Error: response cut off: %s\n" : "Error: %s\n", resp->error);
+    }
+    out->error = xstrdup(resp->error);
 }
 
-/* ---- Format tool args for display ---- */
-
-static void format_tool_args(const tool_call_t* tc, buf_t* out)
+/* Wait for the first count calls of resp in order, add their results to the
+ * conversation and show a line for each. job[i] is the pool job of call i,
+ * or -1 if it was denied. */
+static void report_calls(
+    agent_t* agent, tool_pool_t* pool, const agent_response_t* resp, const int* job, int count, int tool_output)
 {
-    if (!tc->args)
-    {
-        return;
-    }
-    cJSON* item = NULL;
-    int first = 1;
-    cJSON_ArrayForEach(item, tc->args)
+    for (int i = 0; i < count; i++)
     {
-        if (!first)
-        {
-            buf_append_str(out, " ");
-        }
-        first = 0;
-        buf_append_str(out, item->string);
-        buf_append_str(out, "=");
-        if (cJSON_IsString(item))
+        const tool_call_t* tc = &resp->tool_calls[i];
+        buf_t args_display = { 0 };
+        format_tool_args(tc, &args_display);
+        fprintf(stderr, "%s(%s)", tc->name, args_display.data ? args_display.data : "");
+
+        if (job[i] >= 0)
         {
-            size_t len = strlen(item->valuestring);
-            if (len > 40)
+            char* result = tool_pool_wait(pool, job[i]);
+            if (!result)
             {
-                buf_append_str(out, "\"");
-                buf_append(out, item->valuestring, 37);
-                buf_append_str(out, "...\"");
+                result = strdup("Tool not found or no executor");
+                if (!result)
+                {
+                    fprintf(stderr, "Out of memory\n");
+                    exit(1);
+                }
             }
-            else
+            agent_add_tool_result(agent, tc->id, result);
+
+            if (tool_output)
             {
-                buf_printf(out, "\"%s\"", item->valuestring);
+                fprintf(stderr, "\n%s", result);
             }
-        }
-        else if (cJSON_IsNumber(item))
-        {
-            buf_printf(out, "%g", item->valuedouble);
+
+            fprintf(stderr, " → +%zu chars\n", strlen(result));
+            free(result);
         }
         else
         {
-            buf_append_str(out, "...");
+            buf_t denied_msg = { 0 };
+            buf_printf(&denied_msg, "Tool call %s was denied by user", tc->name);
+            agent_add_tool_result(agent, tc->id, denied_msg.data);
+            buf_free(&denied_msg);
+            fprintf(stderr, " → denied\n");
         }
+        buf_free(&args_display);
     }
 }
 
-/* ---- Agent Loop ---- */
-
 int run_agent_loop(agent_t* agent, const char* prompt, chunk_fn on_chunk, chunk_fn on_reasoning_chunk, void* on_chunk_data, turn_fn on_turn_start,
-    turn_fn on_turn_end, const char* tool_approval, const char** tool_allowlist, int tool_output, loop_result_t* out)
+    turn_fn on_turn_end, policy_t* policy, int tool_workers, const char** tool_serial, int shell_session, int tool_output,
+    loop_result_t* out)
 {
     memset(out, 0, sizeof(*out));
     buf_t final_text = { 0 };
 
+    shell_session_t shell;
+    shell_session_init(&shell);
+    tool_ctx_t ctx = { .shell = shell_session ? &shell : NULL };
+    tool_pool_t pool;
+    tool_pool_init(&pool, tool_workers, tool_serial, &ctx);
+    speculation_t sp;
+    speculation_init(&sp, policy, &pool);
+    agent->on_tool_ready = speculate;
+    agent->tool_ready_data = &sp;
+
     agent_response_t resp;
     if (on_turn_start)
     {
@@ -226,13 +271,8 @@ int run_agent_loop(agent_t* agent, const char* prompt, chunk_fn on_chunk, chunk_
     }
     if (ret < 0)
     {
-        if (resp.error && resp.error[0])
-        {
-            fprintf(stderr, "Error: %s\n", resp.error);
-        }
-        out->text = buf_detach(&final_text);
-        agent_response_free(&resp);
-        return -1;
+        report_send_error(&resp, &final_text, out);
+        goto done;
     }
 
     if (resp.text)
@@ -242,9 +282,6 @@ int run_agent_loop(agent_t* agent, const char* prompt, chunk_fn on_chunk, chunk_
     out->input_tokens += resp.input_tokens;
     out->output_tokens += resp.output_tokens;
 
-    approver_t ap;
-    approver_init(&ap, tool_approval, tool_allowlist);
-
     int turn = 0;
     while (resp.tool_call_count > 0)
     {
@@ -255,58 +292,48 @@ int run_agent_loop(agent_t* agent, const char* prompt, chunk_fn on_chunk, chunk_
         }
         fprintf(stderr, "\n");
 
+        /* Each approved call goes to the pool at once, so it runs while the
+         * user considers the next; results are reported in call order once
+         * all are settled. Calls started while the response streamed are
+         * already on it. */
+        int* job = malloc((size_t)resp.tool_call_count * sizeof(int));
+        if (!job)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        int early = 1;
         for (int i = 0; i < resp.tool_call_count; i++)
         {
             tool_call_t* tc = &resp.tool_calls[i];
-            int continue_session = 1;
-            int allowed = approver_check(&ap, tc, &continue_session);
-
-            if (!continue_session)
+            job[i] = early ? speculation_job(&sp, i, tc) : -1;
+            if (job[i] >= 0)
             {
-                fprintf(stderr, "\nOperation cancelled by user.\n");
-                agent_response_free(&resp);
-                approver_free(&ap);
-                out->text = buf_detach(&final_text);
-                return 0;
+                continue;
             }
+            /* Later early starts would be out of order with this call */
+            early = 0;
 
-            buf_t args_display = { 0 };
-            format_tool_args(tc, &args_display);
-            fprintf(stderr, "%s(%s)", tc->name, args_display.data ? args_display.data : "");
-
-            if (allowed)
+            int cancel = 0;
+            int allowed = policy_check(policy, tc->name, tc->args, &cancel);
+            if (cancel)
             {
-                char* result = tools_execute(tc->name, tc->args);
-                if (!result)
-                {
-                    result = strdup("Tool not found or no executor");
-                    if (!result)
-                    {
-                        fprintf(stderr, "Out of memory\n");
-                        exit(1);
-                    }
-                }
-                agent_add_tool_result(agent, tc->id, result);
-
-                if (tool_output)
-                {
-                    fprintf(stderr, "\n%s", result);
-                }
-
-                fprintf(stderr, " → +%zu chars\n", strlen(result));
-                free(result);
-            }
-            else
-            {
-                buf_t denied_msg = { 0 };
-                buf_printf(&denied_msg, "Tool call %s was denied by user", tc->name);
-                agent_add_tool_result(agent, tc->id, denied_msg.data);
-                buf_free(&denied_msg);
-                fprintf(stderr, " → denied\n");
+                /* Calls already approved may have changed things: show
+                 * what they did before stopping */
+                fprintf(stderr, "\nOperation cancelled by user.\n");
+                report_calls(agent, &pool, &resp, job, i, tool_output);
+                free(job);
+                ret = 0;
+                goto done;
             }
-            buf_free(&args_display);
+            job[i] = allowed ? tool_pool_submit(&pool, tc->name, tc->args) : -1;
         }
 
+        report_calls(agent, &pool, &resp, job, resp.tool_call_count, tool_output);
+        free(job);
+        tool_pool_clear(&pool);
+        speculation_reset(&sp);
+
         agent_response_free(&resp);
 
         /* Send empty prompt to get follow-up response */
@@ -321,11 +348,8 @@ int run_agent_loop(agent_t* agent, const char* prompt, chunk_fn on_chunk, chunk_
         }
         if (ret < 0)
         {
-            if (resp.error && resp.error[0])
-            {
-                fprintf(stderr, "Error: %s\n", resp.error);
-            }
-            agent_response_free(&resp);
+            report_send_error(&resp, &final_text, out);
+            ret = 0;
             break;
         }
 
@@ -337,14 +361,21 @@ int run_agent_loop(agent_t* agent, const char* prompt, chunk_fn on_chunk, chunk_
         out->output_tokens += resp.output_tokens;
     }
 
+done:
+    /* Calls started for a response that is not acted on finish unseen */
+    agent->on_tool_ready = NULL;
+    agent->tool_ready_data = NULL;
+    tool_pool_free(&pool);
+    shell_session_free(&shell);
+    speculation_free(&sp);
     agent_response_free(&resp);
-    approver_free(&ap);
     out->text = buf_detach(&final_text);
-    return 0;
+    return ret;
 }
 
 void loop_result_free(loop_result_t* r)
 {
     free(r->text);
+    free(r->error);
     memset(r, 0, sizeof(*r));
 }
@@ -2,12 +2,15 @@
 #define RUNNER_H
 
 #include "agent.h"
+#include "policy.h"
 
 typedef struct
 {
     char* text; /* final accumulated text (all turns) */
     int input_tokens; /* total across all turns */
     int output_tokens;
+    char* error; /* why the loop stopped early, or NULL */
+    int partial; /* it stopped mid-response; text ends with what was streamed */
 } loop_result_t;
 
 /* Called before/after each request to the model. Both are optional (may be NULL). */
@@ -16,9 +19,15 @@ typedef void (*turn_fn)(void* userdata);
 /* Run the agent loop with tool calling.
  * on_turn_start: called just before each agent_send (spinner enable).
  * on_turn_end:   called just after each agent_send (spinner disable, before tool processing).
+ * Each tool call is decided by policy, which may prompt on the terminal.
+ * The approved tool calls of a turn run on up to tool_workers threads, those
+ * matching tool_serial (fnmatch patterns, may be NULL) alone; see toolpool.h.
+ * With shell_session, shell commands share one shell for the whole loop;
+ * see shell.h.
  * Returns 0 on success, -1 on error. */
 int run_agent_loop(agent_t* agent, const char* prompt, chunk_fn on_chunk, chunk_fn on_reasoning_chunk, void* on_chunk_data, turn_fn on_turn_start,
-    turn_fn on_turn_end, const char* tool_approval, const char** tool_allowlist, int tool_output, loop_result_t* out);
+    turn_fn on_turn_end, policy_t* policy, int tool_workers, const char** tool_serial, int shell_session, int tool_output,
+    loop_result_t* out);
 
 void loop_result_free(loop_result_t* r);
 
@@ -0,0 +1,287 @@
+#include "shell.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Shared interrupted flag (from main.c via http.h) */
+extern volatile sig_atomic_t g_http_interrupted;
+
+/* Sent once to a new shell. INT is caught but does nothing between
+ * commands; during one, the wrapper's trap abandons the whole command line.
+ * set -- keeps the status out of the user's variables. */
+static const char PRELUDE[] = "trap : INT\n"
+                              "__art_run() { trap 'trap : INT; return 130' INT; eval \"$1\"; set -- $?; trap : INT; "
+                              "return $1; }\n";
+
+void shell_session_init(shell_session_t* s)
+{
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+    pthread_mutex_init(&s->lock, NULL);
+}
+
+static int send_all(int fd, const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int start(shell_session_t* s, char* errbuf, size_t errlen)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+    {
+        snprintf(errbuf, errlen, "socketpair() failed");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(sv[0]);
+        close(sv[1]);
+        snprintf(errbuf, errlen, "fork() failed");
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        /* Child: its own process group, so an interrupt reaches the shell
+         * and its jobs but not art */
+        setpgid(0, 0);
+        dup2(sv[1], STDIN_FILENO);
+        dup2(sv[1], STDOUT_FILENO);
+        dup2(sv[1], STDERR_FILENO);
+        execl("/bin/sh", "sh", "-s", (char*)NULL);
+        _exit(127);
+    }
+
+    /* Also from this side, so it holds before the first kill() */
+    setpgid(pid, 0);
+    close(sv[1]);
+    s->pid = pid;
+    s->fd = sv[0];
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    s->nonce = ((unsigned long)ts.tv_sec << 20) ^ (unsigned long)ts.tv_nsec ^ ((unsigned long)pid * 2654435761UL);
+    s->seq = 0;
+
+    /* A failure shows up as EOF when the first command is read */
+    send_all(s->fd, PRELUDE, sizeof(PRELUDE) - 1);
+    return 0;
+}
+
+/* Close the connection and reap the shell. Returns its exit code, or -1 if
+ * a signal ended it. */
+static int end(shell_session_t* s)
+{
+    close(s->fd);
+    int status = 0;
+    waitpid(s->pid, &status, 0);
+    s->fd = -1;
+    s->pid = 0;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void shell_session_free(shell_session_t* s)
+{
+    if (s->pid)
+    {
+        /* The shell is idle; EOF on its input ends it */
+        end(s);
+    }
+    pthread_mutex_destroy(&s->lock);
+}
+
+/* Drop what background jobs printed since the last command. Returns 0 if
+ * the shell has gone away meanwhile. */
+static int drain(shell_session_t* s)
+{
+    char tmp[4096];
+    for (;;)
+    {
+        ssize_t n = recv(s->fd, tmp, sizeof(tmp), MSG_DONTWAIT);
+        if (n == 0)
+        {
+            return 0;
+        }
+        if (n < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+    }
+}
+
+/* Move len bytes to the result, up to max_output. Returns 1 if some did
+ * not fit. */
+static int keep(shell_result_t* r, const char* data, size_t len, size_t max_output)
+{
+    size_t room = max_output > r->output.len ? max_output - r->output.len : 0;
+    if (len > room)
+    {
+        buf_append(&r->output, data, room);
+        return 1;
+    }
+    buf_append(&r->output, data, len);
+    return 0;
+}
+
+static long elapsed_ms(const struct timeval* start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (long)(now.tv_sec - start->tv_sec) * 1000 + (long)(now.tv_usec - start->tv_usec) / 1000;
+}
+
+int shell_session_run(shell_session_t* s, const char* command, int timeout, size_t max_output, shell_result_t* r,
+    char* errbuf, size_t errlen)
+{
+    memset(r, 0, sizeof(*r));
+
+    pthread_mutex_lock(&s->lock);
+    if (s->pid && !drain(s))
+    {
+        end(s);
+    }
+    if (!s->pid && start(s, errbuf, errlen) < 0)
+    {
+        pthread_mutex_unlock(&s->lock);
+        return -1;
+    }
+
+    /* The command goes single-quoted to the wrapper, which evals it; the
+     * marker line after it says it is over and how it went */
+    char marker[64];
+    size_t mlen = (size_t)snprintf(marker, sizeof(marker), "\n__art_%lx_%lu ", s->nonce, ++s->seq);
+    buf_t line = { 0 };
+    buf_append_str(&line, "__art_run '");
+    for (const char* c = command; *c;)
+    {
+        const char* q = strchr(c, '\'');
+        size_t n = q ? (size_t)(q - c) : strlen(c);
+        buf_append(&line, c, n);
+        if (!q)
+        {
+            break;
+        }
+        buf_append_str(&line, "'\\''");
+        c = q + 1;
+    }
+    buf_printf(&line, "' </dev/null; printf '\\n__art_%lx_%lu %%d\\n' \"$?\"\n", s->nonce, s->seq);
+    send_all(s->fd, line.data, line.len);
+    buf_free(&line);
+
+    /* Read until the marker line, holding back a tail that may be the
+     * start of it */
+    buf_t pending = { 0 };
+    struct timeval start_tv;
+    gettimeofday(&start_tv, NULL);
+    long deadline = (long)timeout * 1000;
+    int interrupted = 0;
+    int found = 0;
+    while (!found)
+    {
+        long elapsed = elapsed_ms(&start_tv);
+        if (!interrupted && (elapsed >= deadline || r->truncated || g_http_interrupted))
+        {
+            kill(-s->pid, SIGINT);
+            interrupted = 1;
+            r->truncated = 1;
+            deadline = elapsed + SHELL_KILL_GRACE * 1000L;
+        }
+        else if (interrupted && elapsed >= deadline)
+        {
+            kill(-s->pid, SIGKILL);
+            keep(r, pending.data, pending.len, max_output);
+            end(s);
+            r->exit_code = -1;
+            r->ended = 1;
+            break;
+        }
+
+        /* Wake at least every second to notice an interrupt */
+        long wait_ms = deadline - elapsed;
+        if (wait_ms > 1000)
+        {
+            wait_ms = 1000;
+        }
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(s->fd, &rfds);
+        struct timeval tv = { .tv_sec = wait_ms / 1000, .tv_usec = (wait_ms % 1000) * 1000 };
+        int sel = select(s->fd + 1, &rfds, NULL, NULL, &tv);
+        if (sel <= 0)
+        {
+            continue;
+        }
+
+        char tmp[4096];
+        ssize_t n = recv(s->fd, tmp, sizeof(tmp), 0);
+        if (n < 0 && errno != EINTR)
+        {
+            n = 0;
+        }
+        if (n == 0)
+        {
+            /* The shell exited, perhaps by the command's own exit */
+            keep(r, pending.data, pending.len, max_output);
+            r->exit_code = end(s);
+            r->ended = 1;
+            break;
+        }
+        if (n < 0)
+        {
+            continue;
+        }
+        buf_append(&pending, tmp, (size_t)n);
+
+        char* m = memmem(pending.data, pending.len, marker, mlen);
+        if (m)
+        {
+            char* status = m + mlen;
+            if (memchr(status, '\n', (size_t)(pending.data + pending.len - status)))
+            {
+                keep(r, pending.data, (size_t)(m - pending.data), max_output);
+                r->exit_code = atoi(status);
+                found = 1;
+            }
+        }
+        else if (pending.len > mlen + 16)
+        {
+            size_t done = pending.len - (mlen + 16);
+            if (keep(r, pending.data, done, max_output))
+            {
+                r->truncated = 1;
+            }
+            memmove(pending.data, pending.data + done, pending.len - done);
+            pending.len -= done;
+            pending.data[pending.len] = '\0';
+        }
+    }
+    buf_free(&pending);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
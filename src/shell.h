@@ -0,0 +1,55 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+#include "buf.h"
+
+#include <pthread.h>
+#include <sys/types.h>
+
+/* A long-lived /bin/sh that runs the shell tool's commands one after
+ * another, so the working directory, variables and functions one command
+ * sets are there for the next.
+ *
+ * The shell reads commands from, and writes everything to, one end of a
+ * socket pair. Each command runs inside a wrapper function with stdin from
+ * /dev/null and is followed by a marker line carrying a per-session nonce,
+ * a sequence number and the command's exit status, which ends its output.
+ *
+ * A command that runs out of time, or of output, is interrupted: SIGINT
+ * goes to the shell's process group, and the wrapper's trap returns from
+ * the whole command line with status 130 while the shell lives on. If the
+ * marker still does not come within SHELL_KILL_GRACE seconds, the group is
+ * killed and the next command starts a new shell. */
+
+#define SHELL_KILL_GRACE 2
+
+typedef struct shell_session
+{
+    pid_t pid; /* 0 until the first command starts the shell */
+    int fd; /* our end of the shell's stdin and stdout */
+    unsigned long nonce;
+    unsigned long seq; /* commands sent */
+    pthread_mutex_t lock; /* one command at a time */
+} shell_session_t;
+
+typedef struct
+{
+    buf_t output; /* stdout and stderr, at most max_output bytes */
+    int exit_code; /* -1 if the shell had to be killed */
+    int truncated; /* interrupted by the timeout or the output cap */
+    int ended; /* the shell is gone, with all it had set up */
+} shell_result_t;
+
+void shell_session_init(shell_session_t* s);
+
+/* End the shell; background jobs it started are left running. */
+void shell_session_free(shell_session_t* s);
+
+/* Run command, starting the shell first if there is none, and collect its
+ * result into r (to be freed with buf_free(&r->output)). timeout is in
+ * seconds. Returns 0, or -1 with errbuf set if no shell could be started.
+ * Safe from any thread; concurrent commands take turns. */
+int shell_session_run(shell_session_t* s, const char* command, int timeout, size_t max_output, shell_result_t* r,
+    char* errbuf, size_t errlen);
+
+#endif
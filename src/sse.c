@@ -1,37 +1,274 @@
 #include "sse.h"
 
+#include <limits.h>
 #include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 void sse_init(sse_parser_t* p, sse_event_fn fn, void* userdata)
 {
+    memset(p, 0, sizeof(*p));
     buf_init(&p->line_buf);
+    buf_init(&p->data_buf);
+    buf_init(&p->event_buf);
+    p->retry_ms = -1;
     p->on_event = fn;
     p->userdata = userdata;
 }
 
-void sse_free(sse_parser_t* p) { buf_free(&p->line_buf); }
+void sse_free(sse_parser_t* p)
+{
+    buf_free(&p->line_buf);
+    buf_free(&p->data_buf);
+    buf_free(&p->event_buf);
+}
 
-size_t sse_feed(sse_parser_t* p, const char* data, size_t len)
+/* Return the first '\n' or '\r' in [s, end), or NULL if there is none.
+ * Lines are short relative to curl's write chunks, so this is where the
+ * parser spends nearly all of its time. */
+static const char* find_eol(const char* s, const char* end)
+{
+#if defined(__AVX2__)
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    while (end - s >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)s);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr)));
+        if (mask)
+        {
+            return s + __builtin_ctz(mask);
+        }
+        s += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i nl16 = _mm_set1_epi8('\n');
+    const __m128i cr16 = _mm_set1_epi8('\r');
+    while (end - s >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)s);
+        unsigned mask
+            = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, nl16), _mm_cmpeq_epi8(v, cr16)));
+        if (mask)
+        {
+            return s + __builtin_ctz(mask);
+        }
+        s += 16;
+    }
+    for (; s < end; s++)
+    {
+        if (*s == '\n' || *s == '\r')
+        {
+            return s;
+        }
+    }
+    return NULL;
+#else
+    /* Scalar fallback: libc memchr is vectorized on most targets, and '\r'
+     * only needs to be searched for up to the first '\n'. */
+    const char* eol = memchr(s, '\n', (size_t)(end - s));
+    const char* cr = memchr(s, '\r', (size_t)((eol ? eol : end) - s));
+    return cr ? cr : eol;
+#endif
+}
+
+/* Move an in-chunk data line into data_buf before the chunk goes away. */
+static void sse_own_data(sse_parser_t* p)
+{
+    if (p->data_ref)
+    {
+        buf_clear(&p->data_buf);
+        buf_append(&p->data_buf, p->data_ref, p->data_ref_len);
+        p->data_ref = NULL;
+        p->data_ref_len = 0;
+    }
+}
+
+static void sse_dispatch_event(sse_parser_t* p)
 {
-    for (size_t i = 0; i < len; i++)
+    if (p->has_data)
     {
-        char c = data[i];
-        if (c == '\n' || c == '\r')
+        const char* data = p->data_ref ? p->data_ref : (p->data_buf.data ? p->data_buf.data : "");
+        size_t len = p->data_ref ? p->data_ref_len : p->data_buf.len;
+
+        /* Skip [DONE] sentinel */
+        if (!(len == 6 && memcmp(data, "[DONE]", 6) == 0))
         {
-            if (p->line_buf.len > 6 && p->line_buf.data && strncmp(p->line_buf.data, "data: ", 6) == 0)
+            sse_event_t ev = {
+                .data = data,
+                .len = len,
+                .event = p->event_buf.len > 0 ? p->event_buf.data : "message",
+            };
+            p->on_event(&ev, p->userdata);
+        }
+    }
+
+    p->has_data = 0;
+    p->data_ref = NULL;
+    p->data_ref_len = 0;
+    buf_clear(&p->data_buf);
+    buf_clear(&p->event_buf);
+}
+
+/* Process one line (without terminator). in_chunk is non-zero when line
+ * points into the caller's chunk rather than line_buf. */
+static void sse_process_line(sse_parser_t* p, const char* line, size_t len, int in_chunk)
+{
+    if (len == 0)
+    {
+        sse_dispatch_event(p);
+        return;
+    }
+    if (line[0] == ':')
+    {
+        /* A keep-alive comment; its bytes already count as progress for the
+         * transfer's stall check */
+        return;
+    }
+
+    /* "field: value", "field:value" or a bare "field" with an empty value */
+    const char* colon = memchr(line, ':', len);
+    size_t name_len = colon ? (size_t)(colon - line) : len;
+    const char* value = colon ? colon + 1 : line + len;
+    if (colon && value < line + len && *value == ' ')
+    {
+        value++;
+    }
+    size_t value_len = (size_t)(line + len - value);
+
+    if (name_len == 4 && memcmp(line, "data", 4) == 0)
+    {
+        if (!p->has_data)
+        {
+            p->has_data = 1;
+            if (in_chunk)
             {
-                /* Skip [DONE] sentinel */
-                if (strcmp(p->line_buf.data + 6, "[DONE]") != 0)
-                {
-                    p->on_event(p->line_buf.data + 6, p->line_buf.len - 6, p->userdata);
-                }
+                p->data_ref = value;
+                p->data_ref_len = value_len;
             }
+            else
+            {
+                buf_append(&p->data_buf, value, value_len);
+            }
+        }
+        else
+        {
+            sse_own_data(p);
+            buf_append(&p->data_buf, "\n", 1);
+            buf_append(&p->data_buf, value, value_len);
+        }
+    }
+    else if (name_len == 5 && memcmp(line, "event", 5) == 0)
+    {
+        buf_clear(&p->event_buf);
+        buf_append(&p->event_buf, value, value_len);
+    }
+    else if (name_len == 5 && memcmp(line, "retry", 5) == 0)
+    {
+        long ms = 0;
+        size_t i = 0;
+        for (; i < value_len && value[i] >= '0' && value[i] <= '9'; i++)
+        {
+            /* Saturate rather than overflow on absurdly long values */
+            int digit = value[i] - '0';
+            ms = ms > (LONG_MAX - digit) / 10 ? LONG_MAX : ms * 10 + digit;
+        }
+        if (value_len > 0 && i == value_len)
+        {
+            p->retry_ms = ms;
+        }
+    }
+    /* "id" and unknown fields are ignored: a chat stream cannot be resumed
+     * from an event ID */
+}
+
+size_t sse_feed(sse_parser_t* p, const char* data, size_t len)
+{
+    const char* s = data;
+    const char* end = data + len;
+
+    /* Strip a leading UTF-8 BOM, which may be split across chunks */
+    while (p->bom < 3 && s < end)
+    {
+        if ((unsigned char)*s != (unsigned char)"\xEF\xBB\xBF"[p->bom])
+        {
+            /* Not a BOM after all: what matched is the start of a line */
+            buf_append(&p->line_buf, "\xEF\xBB\xBF", (size_t)p->bom);
+            p->bom = 3;
+            break;
+        }
+        p->bom++;
+        s++;
+    }
+
+    if (p->skip_lf && s < end)
+    {
+        if (*s == '\n')
+        {
+            s++;
+        }
+        p->skip_lf = 0;
+    }
+
+    while (s < end)
+    {
+        const char* eol = find_eol(s, end);
+        if (!eol)
+        {
+            /* Keep only the trailing partial line for the next chunk */
+            buf_append(&p->line_buf, s, (size_t)(end - s));
+            break;
+        }
+
+        if (p->line_buf.len > 0)
+        {
+            /* Line started in a previous chunk: complete it in line_buf */
+            buf_append(&p->line_buf, s, (size_t)(eol - s));
+            sse_process_line(p, p->line_buf.data, p->line_buf.len, 0);
             buf_clear(&p->line_buf);
         }
         else
         {
-            buf_append(&p->line_buf, &c, 1);
+            /* Whole line is inside this chunk: process it in place */
+            sse_process_line(p, s, (size_t)(eol - s), 1);
+        }
+
+        s = eol + 1;
+        if (*eol == '\r')
+        {
+            /* CRLF is a single terminator, possibly split across chunks */
+            if (s < end)
+            {
+                if (*s == '\n')
+                {
+                    s++;
+                }
+            }
+            else
+            {
+                p->skip_lf = 1;
+            }
         }
     }
+
+    sse_own_data(p);
     return len;
 }
+
+void sse_finish(sse_parser_t* p)
+{
+    /* An event not ended by a blank line may be cut short: discard it */
+    buf_clear(&p->line_buf);
+    p->has_data = 0;
+    p->data_ref = NULL;
+    p->data_ref_len = 0;
+    p->skip_lf = 0;
+    buf_clear(&p->data_buf);
+    buf_clear(&p->event_buf);
+}
@@ -5,11 +5,30 @@
 
 #include <stddef.h>
 
-typedef void (*sse_event_fn)(const char* json, size_t len, void* userdata);
+/* One dispatched SSE event. data may point into the chunk passed to
+ * sse_feed() or into the parser's own buffers; it is not NUL-terminated and
+ * is only valid for the duration of the callback. Multi-line data fields are
+ * joined with '\n'. */
+typedef struct
+{
+    const char* data;
+    size_t len;
+    const char* event; /* event type, "message" when unnamed */
+} sse_event_t;
+
+typedef void (*sse_event_fn)(const sse_event_t* ev, void* userdata);
 
 typedef struct
 {
-    buf_t line_buf;
+    buf_t line_buf; /* partial line carried over from the previous chunk */
+    buf_t data_buf; /* data of the event being assembled */
+    buf_t event_buf; /* event type of the event being assembled */
+    const char* data_ref; /* single data line still inside the current chunk */
+    size_t data_ref_len;
+    int has_data;
+    int skip_lf; /* previous chunk ended in '\r'; drop a leading '\n' */
+    int bom; /* bytes of a leading UTF-8 BOM matched so far, 3 once past it */
+    long retry_ms; /* last "retry:" value, -1 if never sent */
     sse_event_fn on_event;
     void* userdata;
 } sse_parser_t;
@@ -18,4 +37,8 @@ void sse_init(sse_parser_t* p, sse_event_fn fn, void* userdata);
 void sse_free(sse_parser_t* p);
 size_t sse_feed(sse_parser_t* p, const char* data, size_t len);
 
+/* Call at end of stream. A final event the server did not terminate with a
+ * blank line is discarded, as the spec requires, since it may be truncated. */
+void sse_finish(sse_parser_t* p);
+
 #endif
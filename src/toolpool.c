@@ -0,0 +1,256 @@
+#include "toolpool.h"
+
+#include <fnmatch.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JOB_PENDING 0
+#define JOB_RUNNING 1
+#define JOB_DONE 2
+
+static int conflicts(const tool_job_t* a, const tool_job_t* b)
+{
+    if (a->serial || b->serial)
+    {
+        return 1;
+    }
+    if (!a->path || !b->path || strcmp(a->path, b->path) != 0)
+    {
+        return 0;
+    }
+    return !(a->tool->flags & TOOL_READONLY) || !(b->tool->flags & TOOL_READONLY);
+}
+
+/* Whether job n may start: it is pending and nothing earlier that it must
+ * follow is unfinished. Called locked. */
+static int runnable(const tool_pool_t* p, int n)
+{
+    const tool_job_t* job = &p->jobs[n];
+    if (job->state != JOB_PENDING)
+    {
+        return 0;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (p->jobs[i].state != JOB_DONE && conflicts(&p->jobs[i], job))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Run job n, which is marked running, with the lock released meanwhile. */
+static void run_job(tool_pool_t* p, int n)
+{
+    const tool_def_t* tool = p->jobs[n].tool;
+    const cJSON* args = p->jobs[n].args;
+    pthread_mutex_unlock(&p->lock);
+    char* result = tool->executor(args, p->ctx);
+    pthread_mutex_lock(&p->lock);
+    /* jobs may have moved while unlocked */
+    p->jobs[n].result = result;
+    p->jobs[n].state = JOB_DONE;
+    pthread_cond_broadcast(&p->done);
+    pthread_cond_broadcast(&p->work);
+}
+
+/* Set on worker threads, whose signal mask a forked child must not keep:
+ * it survives exec, and a shell command with SIGINT, SIGTERM or SIGPIPE
+ * blocked cannot be stopped by timeout(1), kill or a closed pipe */
+static _Thread_local int on_worker;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void child_after_fork(void)
+{
+    if (on_worker)
+    {
+        sigset_t none;
+        sigemptyset(&none);
+        pthread_sigmask(SIG_SETMASK, &none, NULL);
+    }
+}
+
+static void register_atfork(void)
+{
+    pthread_atfork(NULL, NULL, child_after_fork);
+}
+
+static void* worker(void* arg)
+{
+    tool_pool_t* p = arg;
+
+    /* Leave signals to the main thread, whose blocking reads they interrupt */
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+    on_worker = 1;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->stop)
+    {
+        int n = -1;
+        for (int i = 0; i < p->count && n < 0; i++)
+        {
+            if (runnable(p, i))
+            {
+                n = i;
+            }
+        }
+        if (n < 0)
+        {
+            pthread_cond_wait(&p->work, &p->lock);
+            continue;
+        }
+        p->jobs[n].state = JOB_RUNNING;
+        run_job(p, n);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+void tool_pool_init(tool_pool_t* p, int workers, const char** serial, tool_ctx_t* ctx)
+{
+    memset(p, 0, sizeof(*p));
+    p->workers = workers > 1 ? workers : 1;
+    p->serial = serial;
+    p->ctx = ctx;
+    pthread_once(&atfork_once, register_atfork);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+}
+
+static void start_workers(tool_pool_t* p)
+{
+    p->threads = calloc((size_t)p->workers, sizeof(pthread_t));
+    if (!p->threads)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < p->workers; i++)
+    {
+        if (pthread_create(&p->threads[p->started], NULL, worker, p) == 0)
+        {
+            p->started++;
+        }
+    }
+}
+
+void tool_pool_free(tool_pool_t* p)
+{
+    tool_pool_clear(p);
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    for (int i = 0; i < p->started; i++)
+    {
+        pthread_join(p->threads[i], NULL);
+    }
+    free(p->threads);
+    free(p->jobs);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work);
+    pthread_cond_destroy(&p->done);
+    memset(p, 0, sizeof(*p));
+}
+
+int tool_pool_submit(tool_pool_t* p, const char* name, const cJSON* args)
+{
+    tool_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.tool = tools_find(name);
+    job.args = args;
+    if (job.tool && !job.tool->executor)
+    {
+        job.tool = NULL;
+    }
+    if (!job.tool)
+    {
+        job.state = JOB_DONE;
+    }
+    else
+    {
+        job.path = tools_call_path(job.tool, args);
+        for (const char** s = p->serial; s && *s && !job.serial; s++)
+        {
+            job.serial = fnmatch(*s, name, 0) == 0;
+        }
+    }
+
+    if (!p->threads)
+    {
+        start_workers(p);
+    }
+
+    pthread_mutex_lock(&p->lock);
+    if (p->count >= p->cap)
+    {
+        p->cap = p->cap ? p->cap * 2 : 16;
+        tool_job_t* tmp = realloc(p->jobs, (size_t)p->cap * sizeof(*tmp));
+        if (!tmp)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        p->jobs = tmp;
+    }
+    int n = p->count++;
+    p->jobs[n] = job;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    return n;
+}
+
+char* tool_pool_wait(tool_pool_t* p, int n)
+{
+    pthread_mutex_lock(&p->lock);
+    while (p->jobs[n].state != JOB_DONE)
+    {
+        if (p->started == 0)
+        {
+            /* No workers: run everything up to n in order, here */
+            for (int i = 0; i <= n; i++)
+            {
+                if (p->jobs[i].state == JOB_PENDING)
+                {
+                    p->jobs[i].state = JOB_RUNNING;
+                    run_job(p, i);
+                }
+            }
+            continue;
+        }
+        pthread_cond_wait(&p->done, &p->lock);
+    }
+    char* result = p->jobs[n].result;
+    p->jobs[n].result = NULL;
+    pthread_mutex_unlock(&p->lock);
+    return result;
+}
+
+void tool_pool_clear(tool_pool_t* p)
+{
+    pthread_mutex_lock(&p->lock);
+    for (int i = 0; i < p->count; i++)
+    {
+        if (p->jobs[i].state == JOB_PENDING)
+        {
+            p->jobs[i].state = JOB_DONE;
+        }
+    }
+    for (int i = 0; i < p->count; i++)
+    {
+        while (p->jobs[i].state != JOB_DONE)
+        {
+            pthread_cond_wait(&p->done, &p->lock);
+        }
+        free(p->jobs[i].result);
+        free(p->jobs[i].path);
+    }
+    p->count = 0;
+    pthread_mutex_unlock(&p->lock);
+}
@@ -0,0 +1,59 @@
+#ifndef TOOLPOOL_H
+#define TOOLPOOL_H
+
+#include "tools.h"
+
+#include <cJSON.h>
+#include <pthread.h>
+
+/* Runs the tool calls of a turn on worker threads, as many at once as their
+ * effects allow, while results are still taken in call order.
+ *
+ * A call waits for every earlier call it conflicts with: two calls on the
+ * same file unless both only read it, and anything next to a call whose
+ * tool matches one of the serial patterns (by default "shell", whose
+ * effects are unknown). */
+
+typedef struct
+{
+    const tool_def_t* tool; /* NULL if not found */
+    const cJSON* args; /* borrowed until the job is waited for */
+    char* path; /* file it works on, see tools_call_path() */
+    int serial;
+    int state;
+    char* result;
+} tool_job_t;
+
+typedef struct
+{
+    tool_job_t* jobs;
+    int count;
+    int cap;
+    const char** serial; /* NULL-terminated fnmatch patterns, borrowed */
+    tool_ctx_t* ctx; /* passed to every executor, borrowed */
+    pthread_t* threads;
+    int workers;
+    int started; /* threads running; with none, calls run when waited for */
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+} tool_pool_t;
+
+/* Threads are only started by the first submit. serial and ctx may be
+ * NULL. */
+void tool_pool_init(tool_pool_t* p, int workers, const char** serial, tool_ctx_t* ctx);
+void tool_pool_free(tool_pool_t* p);
+
+/* Queue a call of tool name with args. Returns its job number. */
+int tool_pool_submit(tool_pool_t* p, const char* name, const cJSON* args);
+
+/* Wait for job n and take its malloc'd result, or NULL if the tool does
+ * not exist. */
+char* tool_pool_wait(tool_pool_t* p, int n);
+
+/* Drop jobs not started yet, wait for running ones, and forget them all so
+ * numbering starts over. */
+void tool_pool_clear(tool_pool_t* p);
+
+#endif
@@ -1,5 +1,7 @@
 #include "tools.h"
 #include "buf.h"
+#include "json.h"
+#include "shell.h"
 #include "util.h"
 
 #include <errno.h>
@@ -126,8 +128,9 @@ static int mkdirp(const char* path)
 
 /* ---- read tool ---- */
 
-static char* tool_read(const cJSON* args)
+static char* tool_read(const cJSON* args, tool_ctx_t* ctx)
 {
+    (void)ctx;
     cJSON* jp = cJSON_GetObjectItem(args, "path");
     if (!jp || !cJSON_IsString(jp))
     {
@@ -222,8 +225,9 @@ static char* tool_read(const cJSON* args)
 
 /* ---- write tool ---- */
 
-static char* tool_write(const cJSON* args)
+static char* tool_write(const cJSON* args, tool_ctx_t* ctx)
 {
+    (void)ctx;
     cJSON* jp = cJSON_GetObjectItem(args, "path");
     cJSON* jc = cJSON_GetObjectItem(args, "content");
     if (!jp || !cJSON_IsString(jp))
@@ -294,25 +298,33 @@ static char* tool_write(const cJSON* args)
         }
     }
 
-    cJSON* result = cJSON_CreateObject();
-    cJSON_AddBoolToObject(result, "success", 1);
-    cJSON_AddStringToObject(result, "path", display);
-    cJSON_AddNumberToObject(result, "old_lines", old_count);
-    cJSON_AddNumberToObject(result, "new_lines", new_count);
-    cJSON_AddBoolToObject(result, "is_new_file", is_new);
-    cJSON_AddNullToObject(result, "error");
+    buf_t out = { 0 };
+    json_writer_t w;
+    jw_init(&w, &out);
+    jw_object_begin(&w);
+    jw_key(&w, "success");
+    jw_bool(&w, 1);
+    jw_key(&w, "path");
+    jw_string(&w, display);
+    jw_key(&w, "old_lines");
+    jw_int(&w, old_count);
+    jw_key(&w, "new_lines");
+    jw_int(&w, new_count);
+    jw_key(&w, "is_new_file");
+    jw_bool(&w, is_new);
+    jw_key(&w, "error");
+    jw_null(&w);
+    jw_object_end(&w);
 
-    char* json = cJSON_PrintUnformatted(result);
-    cJSON_Delete(result);
     free(path);
     free(display);
-    return json;
+    return buf_detach(&out);
 }
 
 /* ---- glob tool ---- */
 
 /* Thread-local state for nftw callback */
-static struct
+static _Thread_local struct
 {
     const char* pattern;
     const char* base;
@@ -355,8 +367,9 @@ static int glob_nftw_cb(const char* fpath, const struct stat* sb, int typeflag,
     return 0;
 }
 
-static char* tool_glob(const cJSON* args)
+static char* tool_glob(const cJSON* args, tool_ctx_t* ctx)
 {
+    (void)ctx;
     cJSON* jp = cJSON_GetObjectItem(args, "pattern");
     if (!jp || !cJSON_IsString(jp))
     {
@@ -442,17 +455,22 @@ static char* edit_error(const char* fmt, ...)
     vasprintf(&msg, fmt, ap);
     va_end(ap);
 
-    cJSON* r = cJSON_CreateObject();
-    cJSON_AddBoolToObject(r, "success", 0);
-    cJSON_AddStringToObject(r, "error", msg ? msg : "unknown error");
+    buf_t out = { 0 };
+    json_writer_t w;
+    jw_init(&w, &out);
+    jw_object_begin(&w);
+    jw_key(&w, "success");
+    jw_bool(&w, 0);
+    jw_key(&w, "error");
+    jw_string(&w, msg ? msg : "unknown error");
+    jw_object_end(&w);
     free(msg);
-    char* json = cJSON_PrintUnformatted(r);
-    cJSON_Delete(r);
-    return json;
+    return buf_detach(&out);
 }
 
-static char* tool_edit(const cJSON* args)
+static char* tool_edit(const cJSON* args, tool_ctx_t* ctx)
 {
+    (void)ctx;
     cJSON* jp = cJSON_GetObjectItem(args, "path");
     cJSON* jo = cJSON_GetObjectItem(args, "old_string");
     cJSON* jn = cJSON_GetObjectItem(args, "new_string");
@@ -563,16 +581,25 @@ static char* tool_edit(const cJSON* args)
     int old_line_count = count_lines(old_string);
     int new_line_count = count_lines(new_string);
 
-    cJSON* result = cJSON_CreateObject();
-    cJSON_AddBoolToObject(result, "success", 1);
-    cJSON_AddStringToObject(result, "path", display);
-    cJSON_AddNumberToObject(result, "start_line", start_line);
-    cJSON_AddNumberToObject(result, "old_line_count", old_line_count);
-    cJSON_AddNumberToObject(result, "new_line_count", new_line_count);
-    cJSON_AddNullToObject(result, "error");
-
-    char* json = cJSON_PrintUnformatted(result);
-    cJSON_Delete(result);
+    buf_t out = { 0 };
+    json_writer_t w;
+    jw_init(&w, &out);
+    jw_object_begin(&w);
+    jw_key(&w, "success");
+    jw_bool(&w, 1);
+    jw_key(&w, "path");
+    jw_string(&w, display);
+    jw_key(&w, "start_line");
+    jw_int(&w, start_line);
+    jw_key(&w, "old_line_count");
+    jw_int(&w, old_line_count);
+    jw_key(&w, "new_line_count");
+    jw_int(&w, new_line_count);
+    jw_key(&w, "error");
+    jw_null(&w);
+    jw_object_end(&w);
+
+    char* json = buf_detach(&out);
     free(new_content);
     free(content);
     free(path);
@@ -586,7 +613,67 @@ static char* tool_edit(const cJSON* args)
 #define SHELL_MAX_TIMEOUT 300
 #define SHELL_MAX_OUTPUT (512 * 1024) /* 512KB */
 
-static char* tool_shell(const cJSON* args)
+static char* shell_result_json(const buf_t* output, int exit_code, const char* note)
+{
+    /* Size the result for the output plus the fixed fields */
+    buf_t out = { 0 };
+    buf_reserve(&out, output->len + 128);
+    json_writer_t w;
+    jw_init(&w, &out);
+    jw_object_begin(&w);
+    jw_key(&w, "exit_code");
+    jw_int(&w, exit_code);
+    jw_key(&w, "stdout");
+    jw_string_len(&w, output->data ? output->data : "", output->len);
+    if (note)
+    {
+        jw_key(&w, "note");
+        jw_string(&w, note);
+    }
+    jw_key(&w, "error");
+    jw_null(&w);
+    jw_object_end(&w);
+    return buf_detach(&out);
+}
+
+/* Run command in the loop's shell session, with the same limits and result
+ * as a fresh shell */
+static char* shell_in_session(shell_session_t* session, const char* command, int timeout)
+{
+    shell_result_t r;
+    char err[128];
+    if (shell_session_run(session, command, timeout, SHELL_MAX_OUTPUT, &r, err, sizeof(err)) < 0)
+    {
+        buf_t out = { 0 };
+        json_writer_t w;
+        jw_init(&w, &out);
+        jw_object_begin(&w);
+        jw_key(&w, "exit_code");
+        jw_int(&w, -1);
+        jw_key(&w, "stdout");
+        jw_string(&w, "");
+        jw_key(&w, "error");
+        jw_string(&w, err);
+        jw_object_end(&w);
+        return buf_detach(&out);
+    }
+
+    const char* note = NULL;
+    if (r.ended)
+    {
+        note = r.truncated ? "Output was truncated; the shell was killed and its state is lost"
+                           : "The shell exited; its state is lost";
+    }
+    else if (r.truncated)
+    {
+        note = "Output was truncated";
+    }
+    char* json = shell_result_json(&r.output, r.exit_code, note);
+    buf_free(&r.output);
+    return json;
+}
+
+static char* tool_shell(const cJSON* args, tool_ctx_t* ctx)
 {
     cJSON* jcmd = cJSON_GetObjectItem(args, "command");
     if (!jcmd || !cJSON_IsString(jcmd))
@@ -610,9 +697,16 @@ static char* tool_shell(const cJSON* args)
         }
     }
 
-    /* Use pipe + fork to get both stdout+stderr and enforce timeout */
+    if (ctx && ctx->shell)
+    {
+        return shell_in_session(ctx->shell, jcmd->valuestring, timeout);
+    }
+
+    /* Use pipe + fork to get both stdout+stderr and enforce timeout. The
+     * pipe must not leak into shells forked concurrently by other calls, or
+     * this one would not see EOF until they exit too. */
     int pipefd[2];
-    if (pipe(pipefd) < 0)
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
     {
         return strdup("{\"exit_code\":-1,\"stdout\":\"\",\"error\":\"pipe() failed\"}");
     }
@@ -627,8 +721,15 @@ static char* tool_shell(const cJSON* args)
 
     if (pid == 0)
     {
-        /* Child: redirect stdout and stderr to pipe */
+        /* Child: redirect stdout and stderr to pipe. stdin is not the
+         * user's: they may be answering an approval prompt meanwhile. */
         close(pipefd[0]);
+        int null = open("/dev/null", O_RDONLY);
+        if (null >= 0)
+        {
+            dup2(null, STDIN_FILENO);
+            close(null);
+        }
         dup2(pipefd[1], STDOUT_FILENO);
         dup2(pipefd[1], STDERR_FILENO);
         close(pipefd[1]);
@@ -702,202 +803,152 @@ static char* tool_shell(const cJSON* args)
     waitpid(pid, &status, 0);
     int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
 
-    cJSON* result = cJSON_CreateObject();
-    cJSON_AddNumberToObject(result, "exit_code", exit_code);
-    cJSON_AddStringToObject(result, "stdout", output.data ? output.data : "");
-    if (truncated)
-    {
-        cJSON_AddStringToObject(result, "note", "Output was truncated");
-    }
-    cJSON_AddNullToObject(result, "error");
-
-    char* json = cJSON_PrintUnformatted(result);
-    cJSON_Delete(result);
+    char* json = shell_result_json(&output, exit_code, truncated ? "Output was truncated" : NULL);
     buf_free(&output);
     return json;
 }
 
 /* ---- Tool Registry ---- */
 
-static tool_def_t TOOLS[] = {
-    { .name = "read", .description = "Read the contents of a file.", .parameters = NULL, .executor = tool_read },
-    { .name = "write",
-        .description = "Write or create a file with the given content.",
-        .parameters = NULL,
-        .executor = tool_write },
-    { .name = "glob",
-        .description = "Search for files matching a glob pattern.",
-        .parameters = NULL,
-        .executor = tool_glob },
-    { .name = "edit",
-        .description = "Replace a unique string in a file with a new string. "
-                       "The old_string must appear exactly once.",
-        .parameters = NULL,
-        .executor = tool_edit },
-    { .name = "shell",
-        .description = "Execute a shell command and return its output (stdout and "
-                       "stderr combined). "
-                       "Use for running tests, builds, git commands, etc.",
-        .parameters = NULL,
-        .executor = tool_shell },
+/* Schemas are assembled from string literals at compile time, so nothing is
+ * built or serialized at runtime. Names and descriptions are spliced into
+ * JSON verbatim and must not contain '"' or '\'. */
+#define TOOL_PARAM(name, type, desc) "\"" name "\":{\"type\":\"" type "\",\"description\":\"" desc "\"}"
+#define TOOL_PARAMS(required, props) "{\"type\":\"object\",\"required\":[" required "],\"properties\":{" props "}}"
+#define TOOL(nm, desc, params, fn, fl)                                                                               \
+    {                                                                                                                \
+        .name = nm, .description = desc, .parameters = params,                                                       \
+        .schema = "{\"type\":\"function\",\"function\":{\"name\":\"" nm "\",\"description\":\"" desc                 \
+                  "\",\"parameters\":" params "}}",                                                                  \
+        .executor = fn, .flags = fl                                                                                  \
+    }
+
+static const tool_def_t TOOLS[] = {
+    TOOL("read", "Read the contents of a file.",
+        TOOL_PARAMS("\"path\"",
+            TOOL_PARAM("path", "string", "Absolute or relative file path.") ","
+            TOOL_PARAM("offset", "integer", "Line number to start reading from (0-based).") ","
+            TOOL_PARAM("limit", "integer", "Maximum number of lines to read.")),
+        tool_read, TOOL_READONLY | TOOL_FILE),
+    TOOL("write", "Write or create a file with the given content.",
+        TOOL_PARAMS("\"path\",\"content\"",
+            TOOL_PARAM("path", "string", "Absolute or relative file path.") ","
+            TOOL_PARAM("content", "string", "Content to write to the file.")),
+        tool_write, TOOL_FILE),
+    TOOL("glob", "Search for files matching a glob pattern.",
+        TOOL_PARAMS("\"pattern\"",
+            TOOL_PARAM("pattern", "string", "Glob pattern (supports ** for recursive).") ","
+            TOOL_PARAM("path", "string", "Directory to search in (default: current directory).")),
+        tool_glob, TOOL_READONLY),
+    TOOL("edit",
+        "Replace a unique string in a file with a new string. "
+        "The old_string must appear exactly once.",
+        TOOL_PARAMS("\"path\",\"old_string\",\"new_string\"",
+            TOOL_PARAM("path", "string", "Absolute or relative file path.") ","
+            TOOL_PARAM("old_string", "string", "The exact text to find and replace. Must be unique.") ","
+            TOOL_PARAM("new_string", "string", "The replacement text.")),
+        tool_edit, TOOL_FILE),
+    TOOL("shell",
+        "Execute a shell command and return its output (stdout and "
+        "stderr combined). "
+        "Use for running tests, builds, git commands, etc.",
+        TOOL_PARAMS("\"command\"",
+            TOOL_PARAM("command", "string", "Shell command to execute.") ","
+            TOOL_PARAM("timeout", "integer", "Timeout in seconds (default: 30, max: 300).")),
+        tool_shell, 0),
 };
 
-static int TOOL_COUNT = sizeof(TOOLS) / sizeof(TOOLS[0]);
+static const int TOOL_COUNT = sizeof(TOOLS) / sizeof(TOOLS[0]);
 
-static cJSON* make_param(const char* type, const char* desc)
+const tool_def_t* tools_list(int* count)
 {
-    cJSON* p = cJSON_CreateObject();
-    cJSON_AddStringToObject(p, "type", type);
-    if (desc)
-    {
-        cJSON_AddStringToObject(p, "description", desc);
-    }
-    return p;
+    *count = TOOL_COUNT;
+    return TOOLS;
 }
 
-static void set_tool_params(const char* name, cJSON* params)
+int tools_match(const tool_def_t* t, const char** patterns)
 {
-    tool_def_t* t = tools_find(name);
-    if (t)
-    {
-        t->parameters = params;
-    }
-    else
+    for (const char** p = patterns; *p; p++)
     {
-        cJSON_Delete(params);
+        if (fnmatch(*p, t->name, 0) == 0)
+        {
+            return 1;
+        }
     }
+    return 0;
 }
 
-void tools_init(void)
+char* tools_get_schemas(const char** patterns)
 {
-    /* read */
-    {
-        cJSON* params = cJSON_CreateObject();
-        cJSON_AddStringToObject(params, "type", "object");
-        cJSON* req = cJSON_CreateArray();
-        cJSON_AddItemToArray(req, cJSON_CreateString("path"));
-        cJSON_AddItemToObject(params, "required", req);
-        cJSON* props = cJSON_CreateObject();
-        cJSON_AddItemToObject(props, "path", make_param("string", "Absolute or relative file path."));
-        cJSON_AddItemToObject(props, "offset", make_param("integer", "Line number to start reading from (0-based)."));
-        cJSON_AddItemToObject(props, "limit", make_param("integer", "Maximum number of lines to read."));
-        cJSON_AddItemToObject(params, "properties", props);
-        set_tool_params("read", params);
-    }
-    /* write */
-    {
-        cJSON* params = cJSON_CreateObject();
-        cJSON_AddStringToObject(params, "type", "object");
-        cJSON* req = cJSON_CreateArray();
-        cJSON_AddItemToArray(req, cJSON_CreateString("path"));
-        cJSON_AddItemToArray(req, cJSON_CreateString("content"));
-        cJSON_AddItemToObject(params, "required", req);
-        cJSON* props = cJSON_CreateObject();
-        cJSON_AddItemToObject(props, "path", make_param("string", "Absolute or relative file path."));
-        cJSON_AddItemToObject(props, "content", make_param("string", "Content to write to the file."));
-        cJSON_AddItemToObject(params, "properties", props);
-        set_tool_params("write", params);
-    }
-    /* glob */
-    {
-        cJSON* params = cJSON_CreateObject();
-        cJSON_AddStringToObject(params, "type", "object");
-        cJSON* req = cJSON_CreateArray();
-        cJSON_AddItemToArray(req, cJSON_CreateString("pattern"));
-        cJSON_AddItemToObject(params, "required", req);
-        cJSON* props = cJSON_CreateObject();
-        cJSON_AddItemToObject(props, "pattern", make_param("string", "Glob pattern (supports ** for recursive)."));
-        cJSON_AddItemToObject(
-            props, "path", make_param("string", "Directory to search in (default: current directory)."));
-        cJSON_AddItemToObject(params, "properties", props);
-        set_tool_params("glob", params);
-    }
-    /* edit */
-    {
-        cJSON* params = cJSON_CreateObject();
-        cJSON_AddStringToObject(params, "type", "object");
-        cJSON* req = cJSON_CreateArray();
-        cJSON_AddItemToArray(req, cJSON_CreateString("path"));
-        cJSON_AddItemToArray(req, cJSON_CreateString("old_string"));
-        cJSON_AddItemToArray(req, cJSON_CreateString("new_string"));
-        cJSON_AddItemToObject(params, "required", req);
-        cJSON* props = cJSON_CreateObject();
-        cJSON_AddItemToObject(props, "path", make_param("string", "Absolute or relative file path."));
-        cJSON_AddItemToObject(
-            props, "old_string", make_param("string", "The exact text to find and replace. Must be unique."));
-        cJSON_AddItemToObject(props, "new_string", make_param("string", "The replacement text."));
-        cJSON_AddItemToObject(params, "properties", props);
-        set_tool_params("edit", params);
-    }
-    /* shell */
-    {
-        cJSON* params = cJSON_CreateObject();
-        cJSON_AddStringToObject(params, "type", "object");
-        cJSON* req = cJSON_CreateArray();
-        cJSON_AddItemToArray(req, cJSON_CreateString("command"));
-        cJSON_AddItemToObject(params, "required", req);
-        cJSON* props = cJSON_CreateObject();
-        cJSON_AddItemToObject(props, "command", make_param("string", "Shell command to execute."));
-        cJSON_AddItemToObject(props, "timeout", make_param("integer", "Timeout in seconds (default: 30, max: 300)."));
-        cJSON_AddItemToObject(params, "properties", props);
-        set_tool_params("shell", params);
+    buf_t out = { 0 };
+    for (int i = 0; i < TOOL_COUNT; i++)
+    {
+        if (tools_match(&TOOLS[i], patterns))
+        {
+            buf_append_str(&out, out.len ? "," : "[");
+            buf_append_str(&out, TOOLS[i].schema);
+        }
+    }
+    if (out.len == 0)
+    {
+        return NULL;
     }
+    buf_append_str(&out, "]");
+    return buf_detach(&out);
 }
 
-void tools_cleanup(void)
+const tool_def_t* tools_find(const char* name)
 {
     for (int i = 0; i < TOOL_COUNT; i++)
     {
-        if (TOOLS[i].parameters)
+        if (strcmp(TOOLS[i].name, name) == 0)
         {
-            cJSON_Delete(TOOLS[i].parameters);
-            TOOLS[i].parameters = NULL;
+            return &TOOLS[i];
         }
     }
+    return NULL;
 }
 
-cJSON* tools_get_schemas(const char** patterns)
+char* tools_canonical_path(const char* input)
 {
-    cJSON* arr = cJSON_CreateArray();
-    for (int i = 0; i < TOOL_COUNT; i++)
+    char* path = resolve_path(input);
+
+    /* A file that does not exist yet keeps its name as spelled; resolve its
+     * directory so "./a" and "a" still compare equal */
+    char* slash = strrchr(path, '/');
+    if (slash && slash != path)
     {
-        for (const char** p = patterns; *p; p++)
+        *slash = '\0';
+        char* dir = realpath(path, NULL);
+        *slash = '/';
+        if (dir)
         {
-            if (fnmatch(*p, TOOLS[i].name, 0) == 0)
-            {
-                cJSON* schema = cJSON_CreateObject();
-                cJSON_AddStringToObject(schema, "type", "function");
-                cJSON* fn = cJSON_CreateObject();
-                cJSON_AddStringToObject(fn, "name", TOOLS[i].name);
-                cJSON_AddStringToObject(fn, "description", TOOLS[i].description);
-                cJSON_AddItemToObject(fn, "parameters", cJSON_Duplicate(TOOLS[i].parameters, 1));
-                cJSON_AddItemToObject(schema, "function", fn);
-                cJSON_AddItemToArray(arr, schema);
-                break;
-            }
+            buf_t b = { 0 };
+            buf_printf(&b, "%s%s", dir, slash);
+            free(dir);
+            free(path);
+            path = buf_detach(&b);
         }
     }
-    return arr;
+    return path;
 }
 
-tool_def_t* tools_find(const char* name)
+char* tools_call_path(const tool_def_t* t, const cJSON* args)
 {
-    for (int i = 0; i < TOOL_COUNT; i++)
+    cJSON* jp = cJSON_GetObjectItem(args, "path");
+    if (!(t->flags & TOOL_FILE) || !jp || !cJSON_IsString(jp))
     {
-        if (strcmp(TOOLS[i].name, name) == 0)
-        {
-            return &TOOLS[i];
-        }
+        return NULL;
     }
-    return NULL;
+    return tools_canonical_path(jp->valuestring);
 }
 
-char* tools_execute(const char* name, const cJSON* args)
+char* tools_execute(const char* name, const cJSON* args, tool_ctx_t* ctx)
 {
-    tool_def_t* t = tools_find(name);
+    const tool_def_t* t = tools_find(name);
     if (!t || !t->executor)
     {
         return NULL;
     }
-    return t->executor(args);
+    return t->executor(args, ctx);
 }
@@ -3,26 +3,54 @@
 
 #include <cJSON.h>
 
+/* Side effects of a tool, for ordering calls that run concurrently */
+#define TOOL_READONLY 1 /* changes nothing */
+#define TOOL_FILE 2 /* works on the one file named by its "path" argument */
+
+struct shell_session;
+
+/* State the tool calls of one agent loop share. Any member may be NULL. */
+typedef struct
+{
+    struct shell_session* shell; /* run shell commands here, not in a fresh sh */
+} tool_ctx_t;
+
 typedef struct
 {
     const char* name;
     const char* description;
-    cJSON* parameters;
-    char* (*executor)(const cJSON* args);
+    const char* parameters; /* JSON schema of the arguments */
+    const char* schema; /* complete OpenAI tool object, pre-serialized */
+    char* (*executor)(const cJSON* args, tool_ctx_t* ctx); /* ctx may be NULL */
+    unsigned flags; /* TOOL_* */
 } tool_def_t;
 
-/* Initialize tool parameter schemas. Call once at startup. */
-void tools_init(void);
-void tools_cleanup(void);
+/* All built-in tools. The table and its schemas are static. */
+const tool_def_t* tools_list(int* count);
+
+/* Non-zero if the tool's name matches any of the NULL-terminated fnmatch
+ * patterns. */
+int tools_match(const tool_def_t* t, const char** patterns);
 
-/* Build OpenAI tool schemas for tools matching fnmatch patterns.
- * patterns is NULL-terminated array. Returns cJSON array (caller owns). */
-cJSON* tools_get_schemas(const char** patterns);
+/* Build the OpenAI tools array for tools matching fnmatch patterns by
+ * joining their pre-serialized schemas. patterns is NULL-terminated.
+ * Returns a malloc'd JSON string, or NULL if no tool matches. */
+char* tools_get_schemas(const char** patterns);
 
 /* Look up a tool by name. Returns NULL if not found. */
-tool_def_t* tools_find(const char* name);
+const tool_def_t* tools_find(const char* name);
+
+/* path (relative, absolute or under ~) as a malloc'd absolute path that
+ * is equal for every spelling of the same file, existing or not. */
+char* tools_canonical_path(const char* path);
+
+/* The file a call of a TOOL_FILE tool works on, canonical as above, or
+ * NULL. */
+char* tools_call_path(const tool_def_t* t, const cJSON* args);
 
-/* Execute a tool by name with given args. Returns malloc'd result string. */
-char* tools_execute(const char* name, const cJSON* args);
+/* Execute a tool by name with given args and ctx (may be NULL). Returns
+ * malloc'd result string. Executors are reentrant; calls may run on several
+ * threads at once. */
+char* tools_execute(const char* name, const cJSON* args, tool_ctx_t* ctx);
 
 #endif
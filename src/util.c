@@ -1,9 +1,14 @@
 #include "util.h"
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 char* xstrdup(const char* s) { return s ? strdup(s) : NULL; }
 
@@ -54,6 +59,187 @@ char* read_file_contents(const char* path, size_t* out_len)
     return buf;
 }
 
+int read_file_append(buf_t* b, const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+    {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fileno(f), &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        fclose(f);
+        return -1;
+    }
+    size_t sz = (size_t)st.st_size;
+    buf_reserve(b, sz);
+    size_t n = sz ? fread(b->data + b->len, 1, sz, f) : 0;
+    int err = ferror(f);
+    fclose(f);
+    if (err)
+    {
+        if (b->data)
+        {
+            b->data[b->len] = '\0';
+        }
+        return -1;
+    }
+    b->len += n;
+    b->data[b->len] = '\0';
+    return 0;
+}
+
+int append_attachments(buf_t* msg, char* const* files, int count, const char** failed)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (msg->len > 0)
+        {
+            buf_append_str(msg, "\n\n");
+        }
+        buf_printf(msg, "--- %s ---\n", files[i]);
+        if (read_file_append(msg, files[i]) < 0)
+        {
+            *failed = files[i];
+            return -1;
+        }
+    }
+    if (msg->len > 0)
+    {
+        buf_append_str(msg, "\n\n---\n\n");
+    }
+    return 0;
+}
+
+void mkdir_parents(const char* path)
+{
+    char* dir = strdup(path);
+    if (!dir)
+    {
+        return;
+    }
+    for (char* p = dir + 1; (p = strchr(p, '/')); p++)
+    {
+        *p = '\0';
+        mkdir(dir, 0755);
+        *p = '/';
+    }
+    free(dir);
+}
+
+static void* map_shared_file(const char* suffix, size_t len, int* fd)
+{
+    char* path = home_path(suffix);
+    if (!path)
+    {
+        return NULL;
+    }
+    mkdir_parents(path);
+    int f = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    free(path);
+    if (f < 0)
+    {
+        return NULL;
+    }
+
+    /* Size it under the lock so a concurrent creator never maps it short */
+    struct stat st;
+    flock(f, LOCK_EX);
+    void* map = MAP_FAILED;
+    if (fstat(f, &st) == 0 && ((size_t)st.st_size >= len || ftruncate(f, (off_t)len) == 0))
+    {
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+    }
+    flock(f, LOCK_UN);
+    if (map == MAP_FAILED)
+    {
+        close(f);
+        return NULL;
+    }
+    *fd = f;
+    return map;
+}
+
+void* map_state_file(const char* suffix, size_t len, int* fd)
+{
+    *fd = -1;
+    void* map = map_shared_file(suffix, len, fd);
+    if (map)
+    {
+        return map;
+    }
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return map;
+}
+
+int64_t state_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void state_lock(pthread_mutex_t* lock, int fd)
+{
+    pthread_mutex_lock(lock);
+    if (fd >= 0)
+    {
+        flock(fd, LOCK_EX);
+    }
+}
+
+void state_unlock(pthread_mutex_t* lock, int fd)
+{
+    if (fd >= 0)
+    {
+        flock(fd, LOCK_UN);
+    }
+    pthread_mutex_unlock(lock);
+}
+
+void* state_slot(
+    void* slots, int count, size_t size, size_t name_max, size_t used_off, const char* name, int* found)
+{
+    /* FNV-1a over the stored (possibly truncated) form of the name */
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; name[i] && i < name_max - 1; i++)
+    {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+
+    char* oldest = NULL;
+    int64_t oldest_used = 0;
+    for (int n = 0; n < count; n++)
+    {
+        char* s = (char*)slots + (size_t)((h + (uint32_t)n) % (uint32_t)count) * size;
+        if (strncmp(s, name, name_max - 1) == 0)
+        {
+            *found = 1;
+            return s;
+        }
+        if (!s[0])
+        {
+            oldest = s;
+            break;
+        }
+        int64_t used;
+        memcpy(&used, s + used_off, sizeof(used));
+        if (!oldest || used < oldest_used)
+        {
+            oldest = s;
+            oldest_used = used;
+        }
+    }
+    *found = 0;
+    return oldest;
+}
+
 void free_string_list(char** list)
 {
     if (!list)
@@ -1,7 +1,11 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include "buf.h"
+
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /* strdup that returns NULL for NULL input (instead of crashing). */
 char* xstrdup(const char* s);
@@ -13,6 +17,45 @@ char* home_path(const char* suffix);
  * If out_len is non-NULL, receives the number of bytes read. */
 char* read_file_contents(const char* path, size_t* out_len);
 
+/* Append the entire file to b, reading straight into its storage.
+ * Returns 0 on success, -1 on failure (b is left unchanged). */
+int read_file_append(buf_t* b, const char* path);
+
+/* Append files as "--- path ---" sections followed by a "---" separator,
+ * the layout of @file attachments. Returns 0, or -1 with *failed set to the
+ * file that could not be read. */
+int append_attachments(buf_t* msg, char* const* files, int count, const char** failed);
+
+/* Create the missing directories above path (not path itself), like
+ * mkdir -p on its dirname. Errors are ignored; opening path reports them. */
+void mkdir_parents(const char* path);
+
+/* Map len bytes of the state file at $HOME/suffix shared, creating it
+ * zero-filled if needed, and set *fd to it for flock(). If the file cannot
+ * be used, anonymous private memory is mapped instead and *fd is -1, so
+ * callers still work within one process. Either way the contents must be
+ * validated, under flock when *fd >= 0. */
+void* map_state_file(const char* suffix, size_t len, int* fd);
+
+/* Wall-clock milliseconds, the time base of state files, which every
+ * process agrees on. */
+int64_t state_now_ms(void);
+
+/* Take a state file for this process's thread (lock) and against other
+ * processes (flock on fd, unless it is -1); flock alone does not exclude
+ * threads sharing fd. */
+void state_lock(pthread_mutex_t* lock, int fd);
+void state_unlock(pthread_mutex_t* lock, int fd);
+
+/* Open-addressed lookup in a state file's table of count slots of size
+ * bytes each. A slot starts with its NUL-terminated name, "" when free, of
+ * at most name_max bytes (longer names are compared truncated), and holds
+ * its last-use time as an int64_t at used_off. Returns name's slot with
+ * *found set, or else the first free slot on its probe path, or the least
+ * recently used one, for the caller to claim. Call it locked. */
+void* state_slot(
+    void* slots, int count, size_t size, size_t name_max, size_t used_off, const char* name, int* found);
+
 /* Free a NULL-terminated array of strings. */
 void free_string_list(char** list);
 